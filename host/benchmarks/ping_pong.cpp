@@ -0,0 +1,528 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// End-to-end latency and throughput between two driver instances over the
+// simulated link. A master sends pings that an echo node sends back, giving
+// the p50/p99/p999 one-way and round-trip latencies; the master then
+// streams to the echo node to measure the sustained packet rate and
+// goodput, compared with a send_packet() loop waiting for each TX_DS or
+// MAX_RT. Every combination of data rate, payload size, CRC width, auto
+// acknowledgement and loss rate is run, results are printed as JSON.
+//
+// usage: ping_pong [pings per run] [seed]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "host/nrf24l01_sim.h"
+#include "nrf24l01/nrf24l01.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define SPI_FREQUENCY		8000000
+#define TICK_PERIOD			1 // in µs, event dispatch granularity of a node
+#define TX_POLL_PERIOD		4 // in µs
+#define TX_TIMEOUT			50000 // in µs
+#define PING_TIMEOUT		20000 // in µs
+#define STREAM_DURATION		200000 // in µs
+#define HEADER_SIZE			8 // sequence number and send time
+#define SETTLING_TIME		130 // in µs, Tx/Rx settling
+
+#define MASTER_PINS			10
+#define ECHO_PINS			20
+
+#define STATUS_TX_DS		0x20
+#define STATUS_MAX_RT		0x10
+
+struct Parameters {
+	NRF24L01::DataRate data_rate;
+	uint8_t payload_size;
+	NRF24L01::CRCwidth crc_width;
+	bool auto_acknowledgement;
+	double loss;
+};
+
+struct Result {
+	uint32_t pings;
+	uint32_t pongs;
+	std::vector<uint32_t> one_way;
+	std::vector<uint32_t> round_trip;
+	uint32_t streamed;
+	uint32_t delivered;
+	uint32_t looped;
+	uint32_t loop_delivered;
+};
+
+// a driver instance with its own bus and simulated chip, on CS, CE and IRQ
+// pins numbered from pins. Nodes share the virtual clock: their code never
+// waits, it is run from ticks instead, out of the EventQueue dispatch, as
+// the main loop of its own MCU would do.
+class Node {
+public:
+	Node(Air &air, PinName pins, NRF24L01::OperationMode mode, const Parameters &parameters):
+			_spi(NC, NC, NC), _chip(air, _spi, pins, pins + 1, pins + 2),
+			_radio(&_spi, pins, pins + 1, pins + 2), _busy(false), _tick(0),
+			_transmitting(false), _transmit_start(0), _status_poll(0)
+	{
+		NRF24L01::Configuration configuration;
+
+		_spi.frequency(SPI_FREQUENCY);
+
+		configuration.mode = mode;
+		configuration.data_rate = parameters.data_rate;
+		configuration.crc_width = parameters.crc_width;
+		configuration.payload_size = parameters.payload_size;
+		configuration.rx_pipes = 0x01;
+		configuration.auto_acknowledgement = parameters.auto_acknowledgement;
+		_radio.initialize(NRF24L01::register_image(configuration));
+		wait_us(Radio::POWER_UP_DELAY);
+
+		_tick = Clock::schedule(TICK_PERIOD, callback(this, &Node::tick));
+	}
+
+	virtual ~Node()
+	{
+		Clock::cancel(_tick);
+	}
+
+	NRF24L01 &radio(void)
+	{
+		return _radio;
+	}
+
+	EventQueue &queue(void)
+	{
+		return _queue;
+	}
+
+protected:
+	// send one packet from Standby-I, transmitted() tells its completion
+	void transmit(const void *buffer, uint8_t length)
+	{
+		_radio.set_com_ce(0);
+		_radio.set_mode(NRF24L01::OperationMode::TRANSCEIVER);
+		_radio.send_packet(buffer, length);
+
+		_transmitting = true;
+		_transmit_start = us_ticker_read();
+		_status_poll = _transmit_start;
+	}
+
+	bool transmitting(void)
+	{
+		return _transmitting;
+	}
+
+	void listen(void)
+	{
+		_radio.set_mode(NRF24L01::OperationMode::RECEIVER);
+		_radio.set_com_ce(1);
+	}
+
+	// wait after a received packet before answering, so that the sender is
+	// back in Rx when the answer is on air: with auto acknowledgement it turns
+	// around once it got the ACK, sent after the settling time, our own Tx
+	// settling covering its Rx settling
+	static uint32_t turnaround(const Parameters &parameters)
+	{
+		uint16_t kbps = static_cast<uint16_t>(parameters.data_rate);
+		uint8_t crc = static_cast<uint8_t>(parameters.crc_width) / 8;
+		uint8_t preamble = (parameters.data_rate == NRF24L01::DataRate::_2MBPS) ? 2 : 1;
+
+		if (!parameters.auto_acknowledgement) {
+			return 0;
+		}
+		// preamble, 5 bytes address, packet control field and CRC
+		return SETTLING_TIME + ((8 * (preamble + 5 + crc) + 9) * 1000 + kbps - 1) / kbps;
+	}
+
+	// node application, called on every tick
+	virtual void poll(void) {}
+
+	virtual void transmitted(bool) {}
+
+private:
+	SPI _spi;
+	Radio _chip;
+	NRF24L01 _radio;
+	EventQueue _queue;
+	bool _busy;
+	uint64_t _tick;
+	bool _transmitting;
+	uint32_t _transmit_start;
+	uint32_t _status_poll;
+
+	void tick(void)
+	{
+		_tick = Clock::schedule(TICK_PERIOD, callback(this, &Node::tick));
+
+		if (!_busy) {
+			_busy = true;
+			if (_transmitting) {
+				poll_transmission();
+			}
+			poll();
+			_queue.dispatch_once();
+			_busy = false;
+		}
+	}
+
+	void poll_transmission(void)
+	{
+		uint32_t now = us_ticker_read();
+		uint8_t status = 0;
+
+		if (now - _status_poll < TX_POLL_PERIOD) {
+			return;
+		}
+		_status_poll = now;
+
+		status = _radio.status_register();
+		if (!(status & (STATUS_TX_DS | STATUS_MAX_RT)) && (now - _transmit_start < TX_TIMEOUT)) {
+			return;
+		}
+
+		if (!(status & STATUS_TX_DS)) {
+			_radio.flush_tx();
+		}
+		_radio.clear_interrupt_flags();
+		_transmitting = false;
+		transmitted(status & STATUS_TX_DS);
+	}
+};
+
+// sends the pings, one at a time, and times the pongs
+class Master: public Node {
+public:
+	Master(Air &air, const Parameters &parameters, Result *result):
+			Node(air, MASTER_PINS, NRF24L01::OperationMode::TRANSCEIVER, parameters),
+			_parameters(parameters), _result(result), _pings(0), _waiting(false), _sent(0),
+			_turnaround(turnaround(parameters)), _pong_time(0)
+	{
+		radio().set_interrupt(NRF24L01::InterruptMode::RX_ONLY);
+		radio().start_rx_engine(&queue(), callback(this, &Master::pong));
+	}
+
+	bool done(void)
+	{
+		return !_waiting && (_result->pings >= _pings);
+	}
+
+	void start(uint32_t pings)
+	{
+		_pings = pings;
+	}
+
+protected:
+	void poll(void) override
+	{
+		uint8_t ping[32] = {0};
+
+		if (_waiting && (us_ticker_read() - _sent > PING_TIMEOUT)) {
+			_waiting = false;
+		}
+		if (_waiting || transmitting() || (_result->pings >= _pings)) {
+			return;
+		}
+		// the echo node listens only once it got the ACK of its pong
+		if (us_ticker_read() - _pong_time < _turnaround) {
+			return;
+		}
+
+		_sent = us_ticker_read();
+		memcpy(ping, &_result->pings, 4);
+		memcpy(ping + 4, &_sent, 4);
+		_result->pings++;
+		_waiting = true;
+
+		transmit(ping, _parameters.payload_size);
+	}
+
+	void transmitted(bool) override
+	{
+		listen();
+	}
+
+private:
+	Parameters _parameters;
+	Result *_result;
+	uint32_t _pings;
+	bool _waiting;
+	uint32_t _sent;
+	uint32_t _turnaround;
+	uint32_t _pong_time;
+
+	void pong(void)
+	{
+		NRF24L01::RxPacket packet;
+		uint32_t sequence = 0;
+
+		while (radio().receive(&packet)) {
+			memcpy(&sequence, packet.payload, 4);
+			// late pongs of timed out pings are ignored
+			if (_waiting && (sequence == _result->pings - 1)) {
+				_result->round_trip.push_back(packet.timestamp - _sent);
+				_result->pongs++;
+				_pong_time = packet.timestamp;
+				_waiting = false;
+			}
+		}
+	}
+};
+
+// sends every ping back
+class Echo: public Node {
+public:
+	Echo(Air &air, const Parameters &parameters, Result *result):
+			Node(air, ECHO_PINS, NRF24L01::OperationMode::RECEIVER, parameters),
+			_result(result), _turnaround(turnaround(parameters)), _pending(false)
+	{
+		radio().set_interrupt(NRF24L01::InterruptMode::RX_ONLY);
+		radio().start_rx_engine(&queue(), callback(this, &Echo::ping));
+		listen();
+	}
+
+protected:
+	void poll(void) override
+	{
+		// the master listens only once it got the ACK of its ping
+		if (_pending && !transmitting() && (us_ticker_read() - _pong.timestamp >= _turnaround)) {
+			_pending = false;
+			transmit(_pong.payload, _pong.length);
+		}
+	}
+
+	void transmitted(bool) override
+	{
+		listen();
+	}
+
+private:
+	Result *_result;
+	uint32_t _turnaround;
+	bool _pending;
+	NRF24L01::RxPacket _pong;
+
+	void ping(void)
+	{
+		uint32_t sent = 0;
+
+		// one ping in flight: the last one received is sent back
+		while (radio().receive(&_pong)) {
+			memcpy(&sent, _pong.payload + 4, 4);
+			_result->one_way.push_back(_pong.timestamp - sent);
+			_pending = true;
+		}
+	}
+
+};
+
+// streams back to back packets, CE held high
+class Streamer: public Node {
+public:
+	Streamer(Air &air, const Parameters &parameters, Result *result):
+			Node(air, MASTER_PINS, NRF24L01::OperationMode::TRANSCEIVER, parameters),
+			_parameters(parameters), _result(result)
+	{
+		radio().start_tx_stream(&queue());
+	}
+
+	~Streamer()
+	{
+		radio().stop_tx_stream();
+	}
+
+protected:
+	void poll(void) override
+	{
+		uint8_t packet[32] = {0};
+
+		memcpy(packet, &_result->streamed, 4);
+		while (radio().queue_packet(packet, _parameters.payload_size, _parameters.auto_acknowledgement)) {
+			_result->streamed++;
+			memcpy(packet, &_result->streamed, 4);
+		}
+	}
+
+private:
+	Parameters _parameters;
+	Result *_result;
+};
+
+// sends packets one at a time with send_packet(), each from Standby-I
+// once the previous one got its TX_DS or MAX_RT
+class Sender: public Node {
+public:
+	Sender(Air &air, const Parameters &parameters, Result *result):
+			Node(air, MASTER_PINS, NRF24L01::OperationMode::TRANSCEIVER, parameters),
+			_parameters(parameters), _result(result)
+	{
+	}
+
+protected:
+	void poll(void) override
+	{
+		uint8_t packet[32] = {0};
+
+		if (transmitting()) {
+			return;
+		}
+		memcpy(packet, &_result->looped, 4);
+		_result->looped++;
+		transmit(packet, _parameters.payload_size);
+	}
+
+private:
+	Parameters _parameters;
+	Result *_result;
+};
+
+// counts the streamed packets, once each
+class Sink: public Node {
+public:
+	Sink(Air &air, const Parameters &parameters, uint32_t *delivered):
+			Node(air, ECHO_PINS, NRF24L01::OperationMode::RECEIVER, parameters),
+			_delivered(delivered), _next(0)
+	{
+		radio().start_rx_engine(&queue(), callback(this, &Sink::received));
+		listen();
+	}
+
+private:
+	uint32_t *_delivered;
+	uint32_t _next;
+
+	void received(void)
+	{
+		NRF24L01::RxPacket packet;
+		uint32_t sequence = 0;
+
+		while (radio().receive(&packet)) {
+			memcpy(&sequence, packet.payload, 4);
+			if (sequence >= _next) {
+				(*_delivered)++;
+				_next = sequence + 1;
+			}
+		}
+	}
+};
+
+uint32_t percentile(std::vector<uint32_t> samples, double rank)
+{
+	size_t index = 0;
+
+	if (samples.empty()) {
+		return 0;
+	}
+	std::sort(samples.begin(), samples.end());
+	// nearest rank
+	index = static_cast<size_t>(rank * samples.size() + 0.999999);
+	if (index) {
+		index--;
+	}
+
+	return samples[std::min(index, samples.size() - 1)];
+}
+
+Result run(const Parameters &parameters, uint32_t pings, uint32_t seed)
+{
+	Result result = {};
+	Air air(seed);
+
+	air.set_loss(parameters.loss);
+
+	{
+		Echo echo(air, parameters, &result);
+		Master master(air, parameters, &result);
+
+		master.start(pings);
+		while (!master.done()) {
+			wait_us(1000);
+		}
+	}
+
+	{
+		Sink sink(air, parameters, &result.delivered);
+		Streamer streamer(air, parameters, &result);
+
+		wait_us(STREAM_DURATION);
+	}
+
+	{
+		Sink sink(air, parameters, &result.loop_delivered);
+		Sender sender(air, parameters, &result);
+
+		wait_us(STREAM_DURATION);
+	}
+
+	return result;
+}
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t pings = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000;
+	uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+	const NRF24L01::DataRate data_rates[] = {
+		NRF24L01::DataRate::_250KBPS, NRF24L01::DataRate::_1MBPS, NRF24L01::DataRate::_2MBPS
+	};
+	const uint8_t payload_sizes[] = {HEADER_SIZE, 16, 32};
+	const NRF24L01::CRCwidth crc_widths[] = {NRF24L01::CRCwidth::_8bits, NRF24L01::CRCwidth::_16bits};
+	const bool auto_acknowledgements[] = {true, false};
+	const double losses[] = {0, 0.01, 0.1};
+	bool first = true;
+
+	printf("{\n\t\"pings\": %u,\n\t\"seed\": %u,\n\t\"results\": [\n", pings, seed);
+	for (NRF24L01::DataRate data_rate : data_rates) {
+		for (uint8_t payload_size : payload_sizes) {
+			for (NRF24L01::CRCwidth crc_width : crc_widths) {
+				for (bool auto_acknowledgement : auto_acknowledgements) {
+					for (double loss : losses) {
+						Parameters parameters = {data_rate, payload_size, crc_width, auto_acknowledgement, loss};
+						Result result = run(parameters, pings, seed);
+						double seconds = STREAM_DURATION / 1000000.0;
+
+						printf("%s\t\t{\"data_rate_kbps\": %u, \"payload\": %u, \"crc_bits\": %u, \"auto_ack\": %s, "
+								"\"loss\": %.2f, \"pongs\": %u, "
+								"\"one_way_us\": {\"p50\": %u, \"p99\": %u, \"p999\": %u}, "
+								"\"round_trip_us\": {\"p50\": %u, \"p99\": %u, \"p999\": %u}, "
+								"\"packets_per_s\": %.0f, \"goodput_kbps\": %.1f, "
+								"\"send_packet_loop\": {\"packets_per_s\": %.0f, \"goodput_kbps\": %.1f}}",
+								first ? "" : ",\n",
+								static_cast<unsigned>(data_rate), payload_size, static_cast<unsigned>(crc_width),
+								auto_acknowledgement ? "true" : "false", loss, result.pongs,
+								percentile(result.one_way, 0.5), percentile(result.one_way, 0.99),
+								percentile(result.one_way, 0.999),
+								percentile(result.round_trip, 0.5), percentile(result.round_trip, 0.99),
+								percentile(result.round_trip, 0.999),
+								result.delivered / seconds, result.delivered * payload_size * 8 / seconds / 1000,
+								result.loop_delivered / seconds,
+								result.loop_delivered * payload_size * 8 / seconds / 1000);
+						fflush(stdout);
+						first = false;
+					}
+				}
+			}
+		}
+	}
+	printf("\n\t]\n}\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// SPI bus cost of the public API: CS assertions, clocked bytes and bus time
+// at a given SPI clock, measured on the host backend with the simulated
+// chip. Results are printed as JSON; when a baseline is given, any API
+// using more transactions or bytes than recorded fails the run.
+//
+// usage: spi_cost [baseline.json] [spi frequency in Hz]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "host/nrf24l01_sim.h"
+#include "nrf24l01/nrf24l01.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define PIN_CS		1
+#define PIN_CE		2
+#define PIN_IRQ		3
+#define PEER_PINS	10 // CS, CE and IRQ of the peer sending a packet
+#define DYNAMIC_LENGTH	12
+
+struct Cost {
+	const char *api;
+	uint32_t transactions;
+	uint32_t bytes;
+};
+
+// counts the CS assertions of the bus
+class ChipSelectCounter {
+public:
+	ChipSelectCounter(PinName cs): _cs(cs), _count(0)
+	{
+		Pins::listen(_cs, this, callback(this, &ChipSelectCounter::edge));
+	}
+
+	~ChipSelectCounter()
+	{
+		Pins::unlisten(_cs, this);
+	}
+
+	uint32_t count(void)
+	{
+		return _count;
+	}
+
+private:
+	PinName _cs;
+	uint32_t _count;
+
+	void edge(int level)
+	{
+		if (!level) {
+			_count++;
+		}
+	}
+};
+
+template <typename F>
+Cost measure(NRF24L01 &radio, SPI &spi, ChipSelectCounter &cs, const char *api, F operation)
+{
+	Cost cost;
+	uint32_t transactions = cs.count();
+	uint64_t bytes = spi.clocked_bytes();
+
+	operation(radio);
+	cost.api = api;
+	cost.transactions = cs.count() - transactions;
+	cost.bytes = static_cast<uint32_t>(spi.clocked_bytes() - bytes);
+
+	return cost;
+}
+
+bool read_baseline(const char *path, const char *api, Cost *cost)
+{
+	FILE *file = fopen(path, "r");
+	char line[256];
+	char name[64];
+	bool found = false;
+
+	if (!file) {
+		return false;
+	}
+	// one {"api": ..., "transactions": ..., "bytes": ...} object per line
+	while (!found && fgets(line, sizeof(line), file)) {
+		if ((sscanf(line, " {\"api\": \"%63[^\"]\", \"transactions\": %u, \"bytes\": %u",
+				name, &cost->transactions, &cost->bytes) == 3) && (std::string(name) == api)) {
+			found = true;
+		}
+	}
+	fclose(file);
+
+	return found;
+}
+
+// puts a dynamic length packet in the Rx FIFO of radio, sent by a peer over
+// the simulated link: radio listens on pipe 0 at the default address
+bool receive_dynamic_packet(Air &air, NRF24L01 &radio, NRF24L01::Configuration configuration)
+{
+	SPI spi(NC, NC, NC);
+	Radio chip(air, spi, PEER_PINS, PEER_PINS + 1, PEER_PINS + 2);
+	NRF24L01 peer(&spi, PEER_PINS, PEER_PINS + 1, PEER_PINS + 2);
+	uint8_t payload[DYNAMIC_LENGTH] = {0};
+
+	configuration.auto_acknowledgement = true;
+	configuration.dynamic_payload = true;
+	configuration.mode = NRF24L01::OperationMode::RECEIVER;
+	radio.initialize(NRF24L01::register_image(configuration));
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	peer.initialize(NRF24L01::register_image(configuration));
+	wait_us(Radio::POWER_UP_DELAY);
+
+	radio.set_com_ce(1);
+	peer.send_packet(payload, sizeof(payload));
+	wait_us(1000);
+
+	return !(radio.fifo_status_register() & 0x01);
+}
+}
+
+int main(int argc, char **argv)
+{
+	const char *baseline = (argc > 1) ? argv[1] : NULL;
+	int frequency = (argc > 2) ? atoi(argv[2]) : 8000000;
+	Air air;
+	SPI spi(NC, NC, NC);
+	Radio chip(air, spi, PIN_CS, PIN_CE, PIN_IRQ);
+	NRF24L01 radio(&spi, PIN_CS, PIN_CE, PIN_IRQ);
+	ChipSelectCounter cs(PIN_CS);
+	NRF24L01::Configuration configuration;
+	std::vector<Cost> costs;
+	uint8_t address[5] = {0x01, 0x02, 0x03, 0x04, 0x05};
+	uint8_t payload[32] = {0};
+	int regressions = 0;
+
+	spi.frequency(frequency);
+	configuration.auto_acknowledgement = true;
+	configuration.dynamic_payload = true;
+
+	costs.push_back(measure(radio, spi, cs, "initialize", [](NRF24L01 &radio) {
+		radio.initialize(NRF24L01::OperationMode::TRANSCEIVER, NRF24L01::DataRate::_2MBPS, 2450);
+	}));
+	costs.push_back(measure(radio, spi, cs, "initialize_register_image", [&configuration](NRF24L01 &radio) {
+		radio.initialize(NRF24L01::register_image(configuration));
+	}));
+	costs.push_back(measure(radio, spi, cs, "set_data_rate", [](NRF24L01 &radio) {
+		radio.set_data_rate(NRF24L01::DataRate::_1MBPS);
+	}));
+	costs.push_back(measure(radio, spi, cs, "set_crc", [](NRF24L01 &radio) {
+		radio.set_crc(NRF24L01::CRCwidth::_16bits);
+	}));
+	costs.push_back(measure(radio, spi, cs, "set_rf_frequency", [](NRF24L01 &radio) {
+		radio.set_rf_frequency(2480);
+	}));
+	costs.push_back(measure(radio, spi, cs, "set_power_up_and_mode", [](NRF24L01 &radio) {
+		radio.set_power_up_and_mode(NRF24L01::OperationMode::TRANSCEIVER);
+	}));
+	costs.push_back(measure(radio, spi, cs, "set_mode", [](NRF24L01 &radio) {
+		radio.set_mode(NRF24L01::OperationMode::RECEIVER);
+	}));
+	costs.push_back(measure(radio, spi, cs, "set_interrupt", [](NRF24L01 &radio) {
+		radio.set_interrupt(NRF24L01::InterruptMode::RX_ONLY);
+	}));
+	costs.push_back(measure(radio, spi, cs, "attach_receive_payload", [&address](NRF24L01 &radio) {
+		radio.attach_receive_payload(NRF24L01::RxAddressPipe::RX_ADDR_P1, address, 12);
+	}));
+	costs.push_back(measure(radio, spi, cs, "set_tx_address", [&address](NRF24L01 &radio) {
+		radio.set_tx_address(address);
+	}));
+	costs.push_back(measure(radio, spi, cs, "send_packet_32", [&payload](NRF24L01 &radio) {
+		radio.send_packet(payload, sizeof(payload));
+	}));
+	costs.push_back(measure(radio, spi, cs, "send_packet_noack_32", [&payload](NRF24L01 &radio) {
+		radio.send_packet_noack(payload, sizeof(payload));
+	}));
+	costs.push_back(measure(radio, spi, cs, "read_packet_32", [&payload](NRF24L01 &radio) {
+		radio.read_packet(payload, sizeof(payload));
+	}));
+	if (!receive_dynamic_packet(air, radio, configuration)) {
+		fprintf(stderr, "no dynamic length packet received\n");
+		return EXIT_FAILURE;
+	}
+	costs.push_back(measure(radio, spi, cs, "read_packet_dynamic", [&payload](NRF24L01 &radio) {
+		if (radio.read_packet(payload) != DYNAMIC_LENGTH) {
+			fprintf(stderr, "read_packet_dynamic: wrong length\n");
+		}
+	}));
+	costs.push_back(measure(radio, spi, cs, "status_register", [](NRF24L01 &radio) {
+		radio.status_register();
+	}));
+	costs.push_back(measure(radio, spi, cs, "fifo_status_register", [](NRF24L01 &radio) {
+		radio.fifo_status_register();
+	}));
+	costs.push_back(measure(radio, spi, cs, "config_status_register", [](NRF24L01 &radio) {
+		radio.config_status_register();
+	}));
+	costs.push_back(measure(radio, spi, cs, "data_rate", [](NRF24L01 &radio) {
+		radio.data_rate();
+	}));
+	costs.push_back(measure(radio, spi, cs, "flush_tx", [](NRF24L01 &radio) {
+		radio.flush_tx();
+	}));
+	// an abort in Tx mode, the send_packet() payload still on air
+	radio.set_mode(NRF24L01::OperationMode::TRANSCEIVER);
+	radio.send_packet(payload, sizeof(payload));
+	costs.push_back(measure(radio, spi, cs, "flush_tx_on_air", [](NRF24L01 &radio) {
+		radio.flush_tx();
+	}));
+
+	printf("{\n\t\"spi_frequency\": %d,\n\t\"results\": [\n", frequency);
+	for (size_t i = 0; i < costs.size(); i++) {
+		Cost expected;
+
+		printf("\t\t{\"api\": \"%s\", \"transactions\": %u, \"bytes\": %u, \"bus_time_us\": %.2f}%s\n",
+				costs[i].api, costs[i].transactions, costs[i].bytes,
+				costs[i].bytes * 8000000.0 / frequency, (i + 1 < costs.size()) ? "," : "");
+
+		if (baseline && read_baseline(baseline, costs[i].api, &expected)
+				&& ((costs[i].transactions > expected.transactions) || (costs[i].bytes > expected.bytes))) {
+			fprintf(stderr, "regression: %s uses %u transactions/%u bytes, baseline %u/%u\n",
+					costs[i].api, costs[i].transactions, costs[i].bytes,
+					expected.transactions, expected.bytes);
+			regressions++;
+		}
+	}
+	printf("\t]\n}\n");
+
+	return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_HOST_H_
+#define CATIE_NRF24L01_HOST_H_
+
+// Host backend: provides the Mbed OS names used by the driver on a plain
+// C++14 toolchain. Time is virtual and only advances through wait_us(),
+// SPI clocking and nrf24l01_host::Clock::advance(), so runs are
+// deterministic. Pins are shared by number: a device model drives the IRQ
+// line and observes CS/CE through nrf24l01_host::Pins.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <type_traits>
+#include <vector>
+
+typedef int PinName;
+
+const PinName NC = -1;
+
+template <typename F>
+class Callback;
+
+template <typename R, typename... A>
+class Callback<R(A...)> {
+public:
+	Callback() {}
+
+	Callback(std::nullptr_t) {}
+
+	Callback(R (*func)(A...)): _func(func) {}
+
+	template <typename T, typename M>
+	Callback(T *obj, M method): _func([obj, method](A... args) { return (obj->*method)(args...); }) {}
+
+	template <typename F, typename = typename std::enable_if<
+			!std::is_same<typename std::decay<F>::type, Callback>::value>::type>
+	Callback(F func): _func(func) {}
+
+	R operator()(A... args) const
+	{
+		return _func(args...);
+	}
+
+	explicit operator bool() const
+	{
+		return static_cast<bool>(_func);
+	}
+
+private:
+	std::function<R(A...)> _func;
+};
+
+template <typename T, typename R, typename... A>
+Callback<R(A...)> callback(T *obj, R (T::*method)(A...))
+{
+	return Callback<R(A...)>(obj, method);
+}
+
+namespace nrf24l01_host {
+
+class Clock {
+public:
+	typedef Callback<void()> Handler;
+
+	static uint32_t now(void)
+	{
+		return static_cast<uint32_t>(state().now);
+	}
+
+	static uint64_t now_64(void)
+	{
+		return state().now;
+	}
+
+	// run every handler due before now + duration, in deadline order
+	static void advance(uint64_t duration)
+	{
+		State &clock = state();
+		uint64_t target = clock.now + duration;
+
+		while (!clock.timers.empty() && (clock.timers.begin()->first.first <= target)) {
+			std::map<std::pair<uint64_t, uint64_t>, Handler>::iterator it = clock.timers.begin();
+			Handler handler = it->second;
+
+			clock.now = it->first.first;
+			clock.timers.erase(it);
+			handler();
+		}
+		// a handler may have waited beyond the target
+		clock.now = std::max(clock.now, target);
+	}
+
+	static uint64_t schedule(uint64_t delay, Handler handler)
+	{
+		State &clock = state();
+		uint64_t id = clock.next_id++;
+
+		clock.timers[std::make_pair(clock.now + delay, id)] = handler;
+
+		return id;
+	}
+
+	static void cancel(uint64_t id)
+	{
+		State &clock = state();
+
+		for (std::map<std::pair<uint64_t, uint64_t>, Handler>::iterator it = clock.timers.begin();
+				it != clock.timers.end(); ++it) {
+			if (it->first.second == id) {
+				clock.timers.erase(it);
+				return;
+			}
+		}
+	}
+
+	static void reset(void)
+	{
+		state().now = 0;
+		state().timers.clear();
+	}
+
+private:
+	struct State {
+		uint64_t now = 0;
+		uint64_t next_id = 1;
+		std::map<std::pair<uint64_t, uint64_t>, Handler> timers;
+	};
+
+	static State &state(void)
+	{
+		static State clock;
+		return clock;
+	}
+};
+
+class Pins {
+public:
+	typedef Callback<void(int)> Listener;
+
+	static int read(PinName pin)
+	{
+		return state()[pin].level;
+	}
+
+	static void write(PinName pin, int level)
+	{
+		Pin &p = state()[pin];
+		std::vector<std::pair<const void *, Listener> > listeners;
+
+		if (pin == NC) {
+			return;
+		}
+		level = level ? 1 : 0;
+		if (p.level == level) {
+			return;
+		}
+		p.level = level;
+
+		// listeners may detach while notified
+		listeners = p.listeners;
+		for (size_t i = 0; i < listeners.size(); i++) {
+			listeners[i].second(level);
+		}
+	}
+
+	static void listen(PinName pin, const void *owner, Listener listener)
+	{
+		if (pin != NC) {
+			state()[pin].listeners.push_back(std::make_pair(owner, listener));
+		}
+	}
+
+	static void unlisten(PinName pin, const void *owner)
+	{
+		std::vector<std::pair<const void *, Listener> > &listeners = state()[pin].listeners;
+
+		for (size_t i = 0; i < listeners.size();) {
+			if (listeners[i].first == owner) {
+				listeners.erase(listeners.begin() + i);
+			} else {
+				i++;
+			}
+		}
+	}
+
+private:
+	struct Pin {
+		int level = 1;
+		std::vector<std::pair<const void *, Listener> > listeners;
+	};
+
+	static std::map<PinName, Pin> &state(void)
+	{
+		static std::map<PinName, Pin> pins;
+		return pins;
+	}
+};
+
+} // namespace nrf24l01_host
+
+inline uint32_t us_ticker_read(void)
+{
+	return nrf24l01_host::Clock::now();
+}
+
+inline void wait_us(int us)
+{
+	nrf24l01_host::Clock::advance(us);
+}
+
+inline void __DMB(void)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+class CriticalSectionLock {
+public:
+	CriticalSectionLock() {}
+};
+
+class DigitalOut {
+public:
+	DigitalOut(PinName pin): _pin(pin) {}
+
+	DigitalOut(PinName pin, int value): _pin(pin)
+	{
+		write(value);
+	}
+
+	void write(int value)
+	{
+		nrf24l01_host::Pins::write(_pin, value);
+	}
+
+	int read(void)
+	{
+		return nrf24l01_host::Pins::read(_pin);
+	}
+
+	DigitalOut &operator=(int value)
+	{
+		write(value);
+		return *this;
+	}
+
+	operator int()
+	{
+		return read();
+	}
+
+private:
+	PinName _pin;
+};
+
+class InterruptIn {
+public:
+	InterruptIn(PinName pin): _pin(pin), _enabled(true)
+	{
+		nrf24l01_host::Pins::listen(_pin, this, callback(this, &InterruptIn::edge));
+	}
+
+	~InterruptIn()
+	{
+		nrf24l01_host::Pins::unlisten(_pin, this);
+	}
+
+	void fall(Callback<void()> func)
+	{
+		_fall = func;
+	}
+
+	void enable_irq(void)
+	{
+		_enabled = true;
+	}
+
+	void disable_irq(void)
+	{
+		_enabled = false;
+	}
+
+	int read(void)
+	{
+		return nrf24l01_host::Pins::read(_pin);
+	}
+
+private:
+	PinName _pin;
+	bool _enabled;
+	Callback<void()> _fall;
+
+	void edge(int level)
+	{
+		if (!level && _enabled && _fall) {
+			_fall();
+		}
+	}
+};
+
+class Timeout {
+public:
+	Timeout(): _id(0) {}
+
+	~Timeout()
+	{
+		detach();
+	}
+
+	void attach_us(Callback<void()> func, uint64_t delay)
+	{
+		detach();
+		_func = func;
+		_id = nrf24l01_host::Clock::schedule(delay, callback(this, &Timeout::fire));
+	}
+
+	void detach(void)
+	{
+		if (_id) {
+			nrf24l01_host::Clock::cancel(_id);
+			_id = 0;
+		}
+	}
+
+private:
+	uint64_t _id;
+	Callback<void()> _func;
+
+	void fire(void)
+	{
+		_id = 0;
+		_func();
+	}
+};
+
+class EventQueue {
+public:
+	int call(Callback<void()> func)
+	{
+		_events.push_back(func);
+		return static_cast<int>(_events.size());
+	}
+
+	template <typename T, typename M>
+	int call(T *obj, M method)
+	{
+		return call(Callback<void()>(obj, method));
+	}
+
+	// run pending events, including the ones posted while dispatching
+	void dispatch_once(void)
+	{
+		while (!_events.empty()) {
+			Callback<void()> func = _events.front();
+
+			_events.pop_front();
+			func();
+		}
+	}
+
+	size_t pending(void)
+	{
+		return _events.size();
+	}
+
+private:
+	std::deque<Callback<void()> > _events;
+};
+
+#define DEVICE_SPI_ASYNCH		1
+#define SPI_EVENT_ERROR			(1 << 1)
+#define SPI_EVENT_COMPLETE		(1 << 2)
+
+typedef Callback<void(int)> event_callback_t;
+
+class SPI {
+public:
+	typedef Callback<uint8_t(uint8_t)> Device;
+
+	// pins are not modelled, only the clock frequency
+	SPI(PinName, PinName, PinName, PinName = NC): _frequency(1000000), _clocked_bytes(0), _async_event(0),
+			_async_tx(NULL), _async_rx(NULL), _async_tx_length(0), _async_rx_length(0), _async_index(0) {}
+
+	~SPI()
+	{
+		if (_async_event) {
+			nrf24l01_host::Clock::cancel(_async_event);
+		}
+	}
+
+	void format(int, int = 0) {}
+
+	void frequency(int hz)
+	{
+		_frequency = hz;
+	}
+
+	// each device model sees every byte clocked on the bus, unselected
+	// devices leave MISO high
+	void attach_device(const void *owner, Device device)
+	{
+		_devices.push_back(std::make_pair(owner, device));
+	}
+
+	void detach_device(const void *owner)
+	{
+		for (size_t i = 0; i < _devices.size();) {
+			if (_devices[i].first == owner) {
+				_devices.erase(_devices.begin() + i);
+			} else {
+				i++;
+			}
+		}
+	}
+
+	// bytes clocked since the bus creation, for bus cost measurements
+	uint64_t clocked_bytes(void)
+	{
+		return _clocked_bytes;
+	}
+
+	// single threaded host: nothing to arbitrate
+	void lock(void) {}
+
+	void unlock(void) {}
+
+	int write(int value)
+	{
+		return clock_byte(static_cast<uint8_t>(value));
+	}
+
+	int write(const char *tx_buffer, int tx_length, char *rx_buffer, int rx_length)
+	{
+		int length = std::max(tx_length, rx_length);
+		uint8_t data = 0;
+
+		for (int i = 0; i < length; i++) {
+			data = clock_byte((i < tx_length) ? static_cast<uint8_t>(tx_buffer[i]) : 0xFF);
+			if (i < rx_length) {
+				rx_buffer[i] = static_cast<char>(data);
+			}
+		}
+
+		return length;
+	}
+
+	// DMA transfer: the bytes are clocked in the background, one per byte
+	// time of the virtual clock, then the callback is called from the clock
+	// as from an interrupt. A blocking access meanwhile is clocked in
+	// between, as on a bus without arbitration.
+	template <typename Type>
+	int transfer(const Type *tx_buffer, int tx_length, Type *rx_buffer, int rx_length,
+			const event_callback_t &callback, int event = SPI_EVENT_COMPLETE)
+	{
+		if (_async_event || (sizeof(Type) != 1)) {
+			return -1;
+		}
+		_async_tx = reinterpret_cast<const char *>(tx_buffer);
+		_async_rx = reinterpret_cast<char *>(rx_buffer);
+		_async_tx_length = tx_length;
+		_async_rx_length = rx_length;
+		_async_index = 0;
+		_async_callback = callback;
+		_async_mask = event;
+		_async_event = nrf24l01_host::Clock::schedule(byte_time(), Callback<void()>(this, &SPI::async_byte));
+
+		return 0;
+	}
+
+private:
+	int _frequency;
+	uint64_t _clocked_bytes;
+	std::vector<std::pair<const void *, Device> > _devices;
+	uint64_t _async_event;
+	const char *_async_tx;
+	char *_async_rx;
+	int _async_tx_length;
+	int _async_rx_length;
+	int _async_index;
+	event_callback_t _async_callback;
+	int _async_mask;
+
+	// 8 bits at the bus frequency, in µs
+	uint64_t byte_time(void)
+	{
+		return 8000000ULL / _frequency;
+	}
+
+	uint8_t exchange(uint8_t value)
+	{
+		uint8_t data = 0xFF;
+
+		for (size_t i = 0; i < _devices.size(); i++) {
+			data &= _devices[i].second(value);
+		}
+
+		_clocked_bytes++;
+
+		return data;
+	}
+
+	uint8_t clock_byte(uint8_t value)
+	{
+		uint8_t data = exchange(value);
+
+		nrf24l01_host::Clock::advance(byte_time());
+
+		return data;
+	}
+
+	void async_byte(void)
+	{
+		int i = _async_index++;
+		uint8_t data = exchange((i < _async_tx_length) ? static_cast<uint8_t>(_async_tx[i]) : 0xFF);
+		event_callback_t callback;
+
+		if (i < _async_rx_length) {
+			_async_rx[i] = static_cast<char>(data);
+		}
+
+		if (_async_index < std::max(_async_tx_length, _async_rx_length)) {
+			_async_event = nrf24l01_host::Clock::schedule(byte_time(), Callback<void()>(this, &SPI::async_byte));
+			return;
+		}
+
+		// the bus is free again when the callback runs
+		_async_event = 0;
+		callback = _async_callback;
+		if (callback && (_async_mask & SPI_EVENT_COMPLETE)) {
+			callback(SPI_EVENT_COMPLETE);
+		}
+	}
+};
+
+#endif // CATIE_NRF24L01_HOST_H_
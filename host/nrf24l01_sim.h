@@ -0,0 +1,852 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_SIM_H_
+#define CATIE_NRF24L01_SIM_H_
+
+// Behavioural nRF24L01+ model for the host backend. Each Radio answers the
+// SPI bytes of one bus, observes its CS/CE pins and drives its IRQ pin.
+// Radios exchange Enhanced ShockBurst frames through a shared Air medium
+// with configurable loss, latency and per channel interference. Everything
+// runs on the virtual clock of the host backend and the random draws come
+// from a seeded generator, so runs are reproducible.
+
+#include "host/nrf24l01_host.h"
+
+namespace nrf24l01_host {
+
+class Radio;
+
+struct Frame {
+	uint8_t channel;
+	uint16_t data_rate; // in kbps
+	uint8_t address[5];
+	uint8_t address_width;
+	uint8_t pid;
+	bool no_ack;
+	bool ack; // acknowledgement frame
+	uint8_t length;
+	uint8_t payload[32];
+};
+
+class Air {
+public:
+	Air(uint32_t seed = 1): _seed(seed ? seed : 1), _loss(0), _latency(0)
+	{
+		for (int i = 0; i < CHANNEL_COUNT; i++) {
+			_interference[i] = 0;
+		}
+	}
+
+	// probability for a frame to be lost, on every channel
+	void set_loss(double loss)
+	{
+		_loss = loss;
+	}
+
+	// propagation and processing latency added to the airtime, in µs
+	void set_latency(uint32_t latency)
+	{
+		_latency = latency;
+	}
+
+	// probability for a frame to be corrupted and for RPD to detect a carrier
+	void set_interference(uint8_t channel, double interference)
+	{
+		if (channel < CHANNEL_COUNT) {
+			_interference[channel] = interference;
+		}
+	}
+
+	double interference(uint8_t channel)
+	{
+		return (channel < CHANNEL_COUNT) ? _interference[channel] : 0;
+	}
+
+	// frames for which drop returns true are lost, on top of the random loss
+	void set_filter(Callback<bool(const Frame &)> drop)
+	{
+		_filter = drop;
+	}
+
+	// uniform draw in [0, 1), xorshift32
+	double random(void)
+	{
+		_seed ^= _seed << 13;
+		_seed ^= _seed >> 17;
+		_seed ^= _seed << 5;
+
+		return (_seed >> 8) / 16777216.0;
+	}
+
+	void attach(Radio *radio)
+	{
+		_radios.push_back(radio);
+	}
+
+	void detach(Radio *radio)
+	{
+		_radios.erase(std::remove(_radios.begin(), _radios.end(), radio), _radios.end());
+	}
+
+	void transmit(Radio *source, const Frame &frame, uint32_t airtime);
+
+private:
+	static const int CHANNEL_COUNT = 126;
+
+	uint32_t _seed;
+	double _loss;
+	uint32_t _latency;
+	double _interference[CHANNEL_COUNT];
+	Callback<bool(const Frame &)> _filter;
+	std::vector<Radio *> _radios;
+};
+
+class Radio {
+public:
+	enum class State : uint8_t {
+		POWER_DOWN,
+		POWERING_UP,
+		STANDBY,
+		RX_SETTLING,
+		RX,
+		TX_SETTLING,
+		TX
+	};
+
+	// datasheet timings, in µs
+	static const uint32_t POWER_UP_DELAY = 1500;
+	static const uint32_t SETTLING_DELAY = 130;
+
+	Radio(Air &air, SPI &spi, PinName cs, PinName ce, PinName irq):
+			_air(air), _spi(spi), _cs(cs), _ce(ce), _irq(irq), _state(State::POWER_DOWN), _event(0), _ack_event(0),
+			_selected(false), _index(0), _command(0), _length(0), _flags(0), _pid(0), _new_payload(true),
+			_waiting_ack(false), _arc_cnt(0), _plos_cnt(0), _rpd(false)
+	{
+		reset_registers();
+		memset(_last_pid, 0xFF, sizeof(_last_pid));
+		memset(_last_checksum, 0, sizeof(_last_checksum));
+
+		_spi.attach_device(this, callback(this, &Radio::spi_byte));
+		Pins::listen(_cs, this, callback(this, &Radio::cs_edge));
+		Pins::listen(_ce, this, callback(this, &Radio::ce_edge));
+		Pins::write(_irq, 1);
+		_air.attach(this);
+	}
+
+	~Radio()
+	{
+		cancel(_event);
+		cancel(_ack_event);
+		_spi.detach_device(this);
+		Pins::unlisten(_cs, this);
+		Pins::unlisten(_ce, this);
+		_air.detach(this);
+	}
+
+	// supply dip: the register file, FIFOs and flags are back to their
+	// power on reset values, the chip powered down
+	void brownout(void)
+	{
+		cancel(_event);
+		cancel(_ack_event);
+		reset_registers();
+		_rx_fifo.clear();
+		_tx_fifo.clear();
+		_flags = 0;
+		_waiting_ack = false;
+		_new_payload = true;
+		_arc_cnt = 0;
+		_plos_cnt = 0;
+		_state = State::POWER_DOWN;
+		update_irq();
+	}
+
+	State state(void) const
+	{
+		return _state;
+	}
+
+	uint8_t register_value(uint8_t address) const
+	{
+		return (address < REGISTER_COUNT) ? _registers[address] : 0;
+	}
+
+	size_t rx_fifo_level(void) const
+	{
+		return _rx_fifo.size();
+	}
+
+	size_t tx_fifo_level(void) const
+	{
+		return _tx_fifo.size();
+	}
+
+	void receive(const Frame &frame)
+	{
+		if (frame.ack) {
+			receive_ack(frame);
+		} else {
+			receive_packet(frame);
+		}
+	}
+
+private:
+	static const uint8_t REGISTER_COUNT = 0x1E;
+	static const uint8_t FIFO_SIZE = 3;
+
+	struct Payload {
+		uint8_t pipe; // Rx pipe, or pipe of an ACK payload
+		bool no_ack;
+		uint8_t length;
+		uint8_t data[32];
+	};
+
+	Air &_air;
+	SPI &_spi;
+	PinName _cs;
+	PinName _ce;
+	PinName _irq;
+	State _state;
+	uint64_t _event;
+	uint64_t _ack_event;
+	uint8_t _registers[REGISTER_COUNT];
+	uint8_t _rx_address_p0[5];
+	uint8_t _rx_address_p1[5];
+	uint8_t _tx_address[5];
+	std::deque<Payload> _rx_fifo;
+	std::deque<Payload> _tx_fifo;
+	bool _selected;
+	uint8_t _index;
+	uint8_t _command;
+	uint8_t _length;
+	uint8_t _buffer[32];
+	uint8_t _flags; // RX_DR, TX_DS, MAX_RT
+	uint8_t _pid;
+	bool _new_payload;
+	bool _waiting_ack;
+	uint8_t _arc_cnt;
+	uint8_t _plos_cnt;
+	bool _rpd;
+	uint8_t _last_pid[6];
+	uint32_t _last_checksum[6];
+
+	/***********************************************************************
+	 * register file
+	 ***********************************************************************/
+	void reset_registers(void)
+	{
+		memset(_registers, 0, sizeof(_registers));
+		_registers[0x00] = 0x08;
+		_registers[0x01] = 0x3F;
+		_registers[0x02] = 0x03;
+		_registers[0x03] = 0x03;
+		_registers[0x04] = 0x03;
+		_registers[0x05] = 0x02;
+		_registers[0x06] = 0x0E;
+		for (uint8_t pipe = 2; pipe < 6; pipe++) {
+			_registers[0x0A + pipe] = 0xC1 + pipe;
+		}
+		memset(_rx_address_p0, 0xE7, sizeof(_rx_address_p0));
+		memset(_rx_address_p1, 0xC2, sizeof(_rx_address_p1));
+		memset(_tx_address, 0xE7, sizeof(_tx_address));
+	}
+
+	uint8_t address_width(void) const
+	{
+		uint8_t aw = _registers[0x03] & 0x03;
+
+		return aw ? aw + 2 : 5;
+	}
+
+	uint16_t data_rate(void) const
+	{
+		if (_registers[0x06] & 0x20) {
+			return 250;
+		}
+		return (_registers[0x06] & 0x08) ? 2000 : 1000;
+	}
+
+	uint8_t status(void) const
+	{
+		uint8_t rx_p_no = _rx_fifo.empty() ? 0x07 : _rx_fifo.front().pipe;
+
+		return _flags | (rx_p_no << 1) | ((_tx_fifo.size() >= FIFO_SIZE) ? 0x01 : 0x00);
+	}
+
+	uint8_t fifo_status(void) const
+	{
+		return ((_tx_fifo.size() >= FIFO_SIZE) ? 0x20 : 0x00) | (_tx_fifo.empty() ? 0x10 : 0x00)
+				| ((_rx_fifo.size() >= FIFO_SIZE) ? 0x02 : 0x00) | (_rx_fifo.empty() ? 0x01 : 0x00);
+	}
+
+	uint8_t *address_register(uint8_t address)
+	{
+		switch (address) {
+			case 0x0A:
+				return _rx_address_p0;
+			case 0x0B:
+				return _rx_address_p1;
+			case 0x10:
+				return _tx_address;
+		}
+		return NULL;
+	}
+
+	uint8_t read_register(uint8_t address, uint8_t index)
+	{
+		uint8_t *bytes = address_register(address);
+
+		if (bytes) {
+			return (index < 5) ? bytes[index] : 0x00;
+		}
+		if (index) {
+			return 0x00;
+		}
+		switch (address) {
+			case 0x07:
+				return status();
+			case 0x08:
+				return (_plos_cnt << 4) | _arc_cnt;
+			case 0x09:
+				// a carrier is detected by the frames seen or by interference
+				return (_rpd || ((_state == State::RX)
+						&& (_air.random() < _air.interference(_registers[0x05])))) ? 0x01 : 0x00;
+			case 0x17:
+				return fifo_status();
+		}
+
+		return (address < REGISTER_COUNT) ? _registers[address] : 0x00;
+	}
+
+	void write_register(uint8_t address, uint8_t index, uint8_t value)
+	{
+		uint8_t *bytes = address_register(address);
+		uint8_t previous = 0;
+
+		if (bytes) {
+			if (index < 5) {
+				bytes[index] = value;
+			}
+			return;
+		}
+		if (index || (address >= REGISTER_COUNT)) {
+			return;
+		}
+
+		switch (address) {
+			case 0x07:
+				// write 1 to clear the interrupt flags
+				_flags &= ~(value & 0x70);
+				update_irq();
+				evaluate();
+				return;
+			case 0x08:
+			case 0x09:
+			case 0x17:
+				// read only
+				return;
+			case 0x05:
+				// PLOS_CNT is reset by a RF_CH write
+				_plos_cnt = 0;
+				break;
+		}
+
+		previous = _registers[address];
+		_registers[address] = value;
+
+		if (address == 0x00) {
+			if ((previous ^ value) & 0x70) {
+				update_irq();
+			}
+			if ((previous ^ value) & 0x03) {
+				evaluate();
+			}
+		}
+	}
+
+	/***********************************************************************
+	 * SPI slave
+	 ***********************************************************************/
+	void cs_edge(int level)
+	{
+		if (!level) {
+			_selected = true;
+			_index = 0;
+			_length = 0;
+		} else if (_selected) {
+			_selected = false;
+			if (_index) {
+				execute();
+			}
+		}
+	}
+
+	uint8_t spi_byte(uint8_t value)
+	{
+		uint8_t response = 0xFF;
+		uint8_t index = _index - 1;
+
+		if (!_selected) {
+			return 0xFF;
+		}
+		if (_index == 0) {
+			_command = value;
+			_index++;
+			return status();
+		}
+
+		if ((_command & 0xE0) == 0x00) {
+			response = read_register(_command & 0x1F, index);
+		} else if ((_command & 0xE0) == 0x20) {
+			write_register(_command & 0x1F, index, value);
+		} else if (_command == 0x61) {
+			if (!_rx_fifo.empty() && (index < _rx_fifo.front().length)) {
+				response = _rx_fifo.front().data[index];
+			} else {
+				response = 0x00;
+			}
+		} else if (_command == 0x60) {
+			response = _rx_fifo.empty() ? 0x00 : _rx_fifo.front().length;
+		} else if ((_command == 0xA0) || (_command == 0xB0) || ((_command & 0xF8) == 0xA8)) {
+			if (index < sizeof(_buffer)) {
+				_buffer[index] = value;
+				_length = index + 1;
+			}
+		}
+		_index++;
+
+		return response;
+	}
+
+	// commands take effect when CS goes high
+	void execute(void)
+	{
+		Payload payload;
+
+		switch (_command) {
+			case 0x61:
+				if (!_rx_fifo.empty()) {
+					_rx_fifo.pop_front();
+				}
+				break;
+			case 0xE1:
+				_tx_fifo.clear();
+				_new_payload = true;
+				break;
+			case 0xE2:
+				_rx_fifo.clear();
+				break;
+			case 0xA0:
+			case 0xB0:
+				if (_tx_fifo.size() < FIFO_SIZE) {
+					payload.pipe = 0;
+					payload.no_ack = (_command == 0xB0) && (_registers[0x1D] & 0x01);
+					payload.length = _length;
+					memcpy(payload.data, _buffer, _length);
+					_tx_fifo.push_back(payload);
+					evaluate();
+				}
+				break;
+			default:
+				if (((_command & 0xF8) == 0xA8) && ((_command & 0x07) < 6) && (_tx_fifo.size() < FIFO_SIZE)) {
+					payload.pipe = _command & 0x07;
+					payload.no_ack = false;
+					payload.length = _length;
+					memcpy(payload.data, _buffer, _length);
+					_tx_fifo.push_back(payload);
+				}
+				break;
+		}
+	}
+
+	/***********************************************************************
+	 * power and radio states
+	 ***********************************************************************/
+	void ce_edge(int)
+	{
+		// both edges: the CE level is read back by evaluate()
+		evaluate();
+	}
+
+	bool ce(void)
+	{
+		return Pins::read(_ce);
+	}
+
+	void update_irq(void)
+	{
+		// MASK_RX_DR, MASK_TX_DS and MASK_MAX_RT are CONFIG bits 6 to 4
+		Pins::write(_irq, (_flags & ~_registers[0x00] & 0x70) ? 0 : 1);
+	}
+
+	void cancel(uint64_t &event)
+	{
+		if (event) {
+			Clock::cancel(event);
+			event = 0;
+		}
+	}
+
+	void schedule(uint32_t delay, void (Radio::*handler)(void))
+	{
+		cancel(_event);
+		_event = Clock::schedule(delay, Callback<void()>([this, handler]() {
+			_event = 0;
+			(this->*handler)();
+		}));
+	}
+
+	void evaluate(void)
+	{
+		bool power_up = _registers[0x00] & 0x02;
+		bool prim_rx = _registers[0x00] & 0x01;
+
+		if (!power_up) {
+			cancel(_event);
+			_waiting_ack = false;
+			_state = State::POWER_DOWN;
+			return;
+		}
+
+		switch (_state) {
+			case State::POWER_DOWN:
+				_state = State::POWERING_UP;
+				schedule(POWER_UP_DELAY, &Radio::powered_up);
+				break;
+			case State::POWERING_UP:
+				break;
+			case State::STANDBY:
+				if (!ce()) {
+					break;
+				}
+				if (prim_rx) {
+					_state = State::RX_SETTLING;
+					schedule(SETTLING_DELAY, &Radio::rx_settled);
+				} else if (tx_ready()) {
+					_state = State::TX_SETTLING;
+					schedule(SETTLING_DELAY, &Radio::transmit);
+				}
+				break;
+			case State::RX_SETTLING:
+			case State::RX:
+				if (!ce() || !prim_rx) {
+					cancel(_event);
+					_state = State::STANDBY;
+					evaluate();
+				}
+				break;
+			case State::TX_SETTLING:
+			case State::TX:
+				// the current packet is always completed
+				break;
+		}
+	}
+
+	void powered_up(void)
+	{
+		_state = State::STANDBY;
+		evaluate();
+	}
+
+	void rx_settled(void)
+	{
+		_state = State::RX;
+		_rpd = false;
+	}
+
+	bool tx_ready(void)
+	{
+		// no transmission while MAX_RT is set
+		return !_tx_fifo.empty() && !(_flags & 0x10);
+	}
+
+	/***********************************************************************
+	 * Enhanced ShockBurst
+	 ***********************************************************************/
+	uint32_t airtime(uint8_t length) const
+	{
+		uint8_t crc = (_registers[0x00] & 0x08) ? ((_registers[0x00] & 0x04) ? 2 : 1) : 0;
+		uint8_t preamble = (data_rate() == 2000) ? 2 : 1;
+		uint32_t bits = 8 * (preamble + address_width() + length + crc) + 9;
+
+		return (bits * 1000 + data_rate() - 1) / data_rate();
+	}
+
+	uint32_t retransmit_delay(void) const
+	{
+		return 250 * ((_registers[0x04] >> 4) + 1);
+	}
+
+	Frame frame(const uint8_t *address, const Payload &payload, bool ack) const
+	{
+		Frame frame;
+
+		frame.channel = _registers[0x05];
+		frame.data_rate = data_rate();
+		frame.address_width = address_width();
+		memcpy(frame.address, address, sizeof(frame.address));
+		frame.pid = _pid;
+		frame.no_ack = payload.no_ack;
+		frame.ack = ack;
+		frame.length = payload.length;
+		memcpy(frame.payload, payload.data, payload.length);
+
+		return frame;
+	}
+
+	void transmit(void)
+	{
+		// FLUSH_TX while settling or between two retransmissions
+		if (_tx_fifo.empty()) {
+			_waiting_ack = false;
+			_state = State::STANDBY;
+			evaluate();
+			return;
+		}
+
+		const Payload &payload = _tx_fifo.front();
+		bool no_ack = payload.no_ack || !(_registers[0x01] & 0x01);
+
+		_state = State::TX;
+		if (_new_payload) {
+			_pid = (_pid + 1) & 0x03;
+			_arc_cnt = 0;
+			_new_payload = false;
+		}
+
+		_air.transmit(this, frame(_tx_address, payload, false), airtime(payload.length));
+
+		if (no_ack) {
+			_waiting_ack = false;
+			schedule(airtime(payload.length), &Radio::transmitted);
+		} else {
+			_waiting_ack = true;
+			schedule(airtime(payload.length) + retransmit_delay(), &Radio::ack_timeout);
+		}
+	}
+
+	void transmitted(void)
+	{
+		// the frame on air completes even if flushed meanwhile
+		if (!_tx_fifo.empty()) {
+			_tx_fifo.pop_front();
+		}
+		_new_payload = true;
+		_flags |= 0x20;
+		update_irq();
+		next_transmission();
+	}
+
+	void ack_timeout(void)
+	{
+		_waiting_ack = false;
+
+		if (_arc_cnt < (_registers[0x04] & 0x0F)) {
+			_arc_cnt++;
+			transmit();
+			return;
+		}
+
+		// payload stays in the Tx FIFO until flushed
+		_flags |= 0x10;
+		if (_plos_cnt < 15) {
+			_plos_cnt++;
+		}
+		update_irq();
+		_state = State::STANDBY;
+	}
+
+	void next_transmission(void)
+	{
+		// with CE held high the next payload goes out without settling
+		if (ce() && !(_registers[0x00] & 0x01) && tx_ready()) {
+			transmit();
+		} else {
+			_state = State::STANDBY;
+			evaluate();
+		}
+	}
+
+	void receive_ack(const Frame &frame)
+	{
+		Payload payload;
+
+		if ((_state != State::TX) || !_waiting_ack || !same_link(frame)
+				|| memcmp(frame.address, _tx_address, address_width()) || (frame.pid != _pid)) {
+			return;
+		}
+
+		cancel(_event);
+		_waiting_ack = false;
+
+		// ACK payloads are received on pipe 0
+		if (frame.length && (_rx_fifo.size() < FIFO_SIZE)) {
+			payload.pipe = 0;
+			payload.no_ack = false;
+			payload.length = frame.length;
+			memcpy(payload.data, frame.payload, frame.length);
+			_rx_fifo.push_back(payload);
+			_flags |= 0x40;
+		}
+		transmitted();
+	}
+
+	void receive_packet(const Frame &frame)
+	{
+		Payload payload;
+		int pipe = -1;
+		uint8_t length = 0;
+		uint32_t checksum = frame.length;
+		bool duplicate = false;
+
+		if ((_state != State::RX) || !same_link(frame)) {
+			return;
+		}
+		_rpd = true;
+
+		pipe = match_pipe(frame);
+		if (pipe < 0) {
+			return;
+		}
+
+		// dynamic payload length, or the static width must match
+		if ((_registers[0x1D] & 0x04) && (_registers[0x1C] & (1 << pipe))) {
+			length = frame.length;
+		} else {
+			length = _registers[0x11 + pipe];
+			if (!length || (length != frame.length)) {
+				return;
+			}
+		}
+
+		if (_rx_fifo.size() >= FIFO_SIZE) {
+			// Rx FIFO full: no ACK, the transmitter retries
+			return;
+		}
+
+		for (uint8_t i = 0; i < frame.length; i++) {
+			checksum = (checksum * 31) + frame.payload[i];
+		}
+		duplicate = (_last_pid[pipe] == frame.pid) && (_last_checksum[pipe] == checksum);
+		_last_pid[pipe] = frame.pid;
+		_last_checksum[pipe] = checksum;
+
+		if (!duplicate || frame.no_ack) {
+			payload.pipe = pipe;
+			payload.no_ack = frame.no_ack;
+			payload.length = length;
+			memcpy(payload.data, frame.payload, length);
+			_rx_fifo.push_back(payload);
+			_flags |= 0x40;
+			update_irq();
+		}
+
+		if ((_registers[0x01] & (1 << pipe)) && !frame.no_ack) {
+			send_ack(frame, pipe);
+		}
+	}
+
+	int match_pipe(const Frame &frame) const
+	{
+		uint8_t aw = address_width();
+
+		if (frame.address_width != aw) {
+			return -1;
+		}
+		if ((_registers[0x02] & 0x01) && !memcmp(frame.address, _rx_address_p0, aw)) {
+			return 0;
+		}
+		if ((_registers[0x02] & 0x02) && !memcmp(frame.address, _rx_address_p1, aw)) {
+			return 1;
+		}
+		// pipes 2 to 5 share the pipe 1 MSBytes
+		for (uint8_t pipe = 2; pipe < 6; pipe++) {
+			if ((_registers[0x02] & (1 << pipe)) && (frame.address[0] == _registers[0x0A + pipe])
+					&& !memcmp(&frame.address[1], &_rx_address_p1[1], aw - 1)) {
+				return pipe;
+			}
+		}
+
+		return -1;
+	}
+
+	bool same_link(const Frame &frame) const
+	{
+		return (frame.channel == _registers[0x05]) && (frame.data_rate == data_rate());
+	}
+
+	void send_ack(const Frame &received, uint8_t pipe)
+	{
+		Payload payload;
+		Frame ack;
+		bool with_payload = false;
+
+		payload.pipe = pipe;
+		payload.no_ack = false;
+		payload.length = 0;
+
+		// first ACK payload queued for this pipe, when enabled
+		if ((_registers[0x1D] & 0x02)) {
+			for (std::deque<Payload>::iterator it = _tx_fifo.begin(); it != _tx_fifo.end(); ++it) {
+				if (it->pipe == pipe) {
+					payload = *it;
+					_tx_fifo.erase(it);
+					with_payload = true;
+					break;
+				}
+			}
+		}
+
+		ack = frame(received.address, payload, true);
+		ack.pid = received.pid;
+
+		cancel(_ack_event);
+		_ack_event = Clock::schedule(SETTLING_DELAY, Callback<void()>([this, ack, with_payload]() {
+			_ack_event = 0;
+			_air.transmit(this, ack, airtime(ack.length));
+			if (with_payload) {
+				// TX_DS is set on the PRX once an ACK payload is sent
+				_flags |= 0x20;
+				update_irq();
+			}
+		}));
+	}
+};
+
+inline void Air::transmit(Radio *source, const Frame &frame, uint32_t airtime)
+{
+	if (_filter && _filter(frame)) {
+		return;
+	}
+	for (size_t i = 0; i < _radios.size(); i++) {
+		Radio *radio = _radios[i];
+
+		if ((radio == source) || (random() < _loss) || (random() < interference(frame.channel))) {
+			continue;
+		}
+		Clock::schedule(airtime + _latency, Callback<void()>([this, radio, frame]() {
+			// the radio may have left the medium meanwhile
+			if (std::find(_radios.begin(), _radios.end(), radio) != _radios.end()) {
+				radio->receive(frame);
+			}
+		}));
+	}
+}
+
+} // namespace nrf24l01_host
+
+#endif // CATIE_NRF24L01_SIM_H_
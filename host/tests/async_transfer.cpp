@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Asynchronous packet transfers on the host backend: completion callbacks,
+// payload integrity over the simulated link, and the bus arbitration of a
+// radio group, where a blocking transaction or a second asynchronous
+// transfer must not interleave with a transfer in progress.
+
+#include "host/tests/test_support.h"
+#include "nrf24l01/radio_group.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define RX_ADDRESS			0xB3B4B5B6B7
+
+struct Completion {
+	int count;
+	int event;
+
+	void done(int e)
+	{
+		count++;
+		event = e;
+	}
+};
+
+NRF24L01::RegisterImage image(NRF24L01::OperationMode mode, uint16_t rf_frequency)
+{
+	NRF24L01::Configuration configuration;
+
+	configuration.mode = mode;
+	configuration.rf_frequency = rf_frequency;
+	configuration.tx_address = RX_ADDRESS;
+	configuration.rx_address = RX_ADDRESS;
+
+	return NRF24L01::register_image(configuration);
+}
+
+void fill(uint8_t *payload, uint8_t seed)
+{
+	for (uint8_t i = 0; i < 32; i++) {
+		payload[i] = seed + 7 * i;
+	}
+}
+
+// every queued packet completes in order and arrives intact
+void test_send_and_read(void)
+{
+	Air air;
+	SPI tx_spi(NC, NC, NC);
+	SPI rx_spi(NC, NC, NC);
+	Radio tx_chip(air, tx_spi, 1, 2, 3);
+	Radio rx_chip(air, rx_spi, 11, 12, 13);
+	NRF24L01 tx(&tx_spi, 1, 2, 3);
+	NRF24L01 rx(&rx_spi, 11, 12, 13);
+	Completion sent = {0, 0};
+	Completion read = {0, 0};
+	uint8_t payloads[3][32];
+	uint8_t received[32];
+
+	tx_spi.frequency(SPI_FREQUENCY);
+	rx_spi.frequency(SPI_FREQUENCY);
+	tx.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2410));
+	rx.initialize(image(NRF24L01::OperationMode::RECEIVER, 2410));
+	rx.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+
+	for (uint8_t i = 0; i < 3; i++) {
+		fill(payloads[i], 0x10 * (i + 1));
+		CHECK(tx.send_packet_async(payloads[i], 32, callback(&sent, &Completion::done)));
+	}
+	// the caller buffers are copied at enqueue time
+	fill(payloads[0], 0);
+	CHECK(sent.count == 0);
+
+	wait_us(2000);
+	CHECK(sent.count == 3);
+	CHECK(sent.event == SPI_EVENT_COMPLETE);
+	// the CE pulses of the payloads loaded during a transmission are lost:
+	// they wait in the Tx FIFO for the next ones
+	CHECK(rx_chip.rx_fifo_level() + tx_chip.tx_fifo_level() == 3);
+	for (uint8_t i = 0; (i < 3) && tx_chip.tx_fifo_level(); i++) {
+		tx.start_transfer();
+		wait_us(500);
+	}
+	CHECK(rx_chip.rx_fifo_level() == 3);
+
+	for (uint8_t i = 0; i < 3; i++) {
+		memset(received, 0, sizeof(received));
+		CHECK(rx.read_packet_async(received, 32, callback(&read, &Completion::done)));
+		wait_us(100);
+		CHECK(read.count == i + 1);
+		fill(payloads[i], 0x10 * (i + 1));
+		CHECK(memcmp(received, payloads[i], 32) == 0);
+		rx.clear_interrupt_flags();
+	}
+	CHECK(rx_chip.rx_fifo_level() == 0);
+}
+
+// a transfer in progress holds the group bus until its completion
+void test_group_arbitration(void)
+{
+	Air air;
+	SPI bus(NC, NC, NC);
+	SPI rx_spi(NC, NC, NC);
+	EventQueue queue;
+	Radio chip_a(air, bus, 21, 22, 23);
+	Radio chip_b(air, bus, 31, 32, 33);
+	Radio rx_chip_a(air, rx_spi, 41, 42, 43);
+	Radio rx_chip_b(air, rx_spi, 51, 52, 53);
+	RadioGroup group(&bus, &queue);
+	NRF24L01 a(&group, 21, 22, 23);
+	NRF24L01 b(&group, 31, 32, 33);
+	NRF24L01 rx_a(&rx_spi, 41, 42, 43);
+	NRF24L01 rx_b(&rx_spi, 51, 52, 53);
+	Completion sent_a = {0, 0};
+	Completion sent_b = {0, 0};
+	uint8_t payload_a[32];
+	uint8_t payload_b[32];
+	uint8_t received[32];
+	uint8_t address[5];
+	uint8_t expected[5];
+
+	bus.frequency(SPI_FREQUENCY);
+	rx_spi.frequency(SPI_FREQUENCY);
+	// separate channels, so that both links can be on air together
+	a.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2420));
+	b.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2470));
+	rx_a.initialize(image(NRF24L01::OperationMode::RECEIVER, 2420));
+	rx_b.initialize(image(NRF24L01::OperationMode::RECEIVER, 2470));
+	rx_a.set_com_ce(1);
+	rx_b.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+
+	// a blocking transaction of the other radio waits for the transfer
+	fill(payload_a, 0x21);
+	CHECK(a.send_packet_async(payload_a, 32, callback(&sent_a, &Completion::done)));
+	b.tx_address(address);
+	for (uint8_t i = 0; i < 5; i++) {
+		expected[i] = (static_cast<uint64_t>(RX_ADDRESS) >> (8 * i)) & 0xFF;
+	}
+	CHECK(memcmp(address, expected, 5) == 0);
+	CHECK(sent_a.count == 0);
+
+	// a second transfer is deferred until the bus is released
+	fill(payload_b, 0x42);
+	CHECK(b.send_packet_async(payload_b, 32, callback(&sent_b, &Completion::done)));
+
+	wait_us(2000);
+	CHECK(sent_a.count == 1);
+	CHECK(sent_b.count == 1);
+	CHECK(rx_chip_a.rx_fifo_level() == 1);
+	CHECK(rx_chip_b.rx_fifo_level() == 1);
+	CHECK(rx_a.read_packet(received) == 32);
+	CHECK(memcmp(received, payload_a, 32) == 0);
+	CHECK(rx_b.read_packet(received) == 32);
+	CHECK(memcmp(received, payload_b, 32) == 0);
+}
+
+// without a group, a transfer finding the SPI busy is started again later
+void test_busy_bus_retry(void)
+{
+	Air air;
+	SPI bus(NC, NC, NC);
+	SPI rx_spi(NC, NC, NC);
+	Radio chip_a(air, bus, 21, 22, 23);
+	Radio chip_b(air, bus, 31, 32, 33);
+	Radio rx_chip_a(air, rx_spi, 41, 42, 43);
+	Radio rx_chip_b(air, rx_spi, 51, 52, 53);
+	NRF24L01 a(&bus, 21, 22, 23);
+	NRF24L01 b(&bus, 31, 32, 33);
+	NRF24L01 rx_a(&rx_spi, 41, 42, 43);
+	NRF24L01 rx_b(&rx_spi, 51, 52, 53);
+	Completion sent_a = {0, 0};
+	Completion sent_b = {0, 0};
+	uint8_t payload_a[32];
+	uint8_t payload_b[32];
+	uint8_t received[32];
+
+	bus.frequency(SPI_FREQUENCY);
+	rx_spi.frequency(SPI_FREQUENCY);
+	a.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2420));
+	b.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2470));
+	rx_a.initialize(image(NRF24L01::OperationMode::RECEIVER, 2420));
+	rx_b.initialize(image(NRF24L01::OperationMode::RECEIVER, 2470));
+	rx_a.set_com_ce(1);
+	rx_b.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+
+	fill(payload_a, 0x13);
+	fill(payload_b, 0x57);
+	CHECK(a.send_packet_async(payload_a, 32, callback(&sent_a, &Completion::done)));
+	CHECK(b.send_packet_async(payload_b, 32, callback(&sent_b, &Completion::done)));
+	// b is neither selected nor counted as loaded until its transfer starts
+	CHECK(Pins::read(31));
+	CHECK(b.statistics().tx_packets == 0);
+
+	wait_us(2000);
+	CHECK(sent_a.count == 1);
+	CHECK(sent_b.count == 1);
+	CHECK(b.statistics().tx_packets == 1);
+	CHECK(rx_a.read_packet(received) == 32);
+	CHECK(memcmp(received, payload_a, 32) == 0);
+	CHECK(rx_b.read_packet(received) == 32);
+	CHECK(memcmp(received, payload_b, 32) == 0);
+}
+}
+
+int main(void)
+{
+	test_send_and_read();
+	test_group_arbitration();
+	test_busy_bus_retry();
+
+	return test_result("async_transfer");
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// send_packet() CE pulse on the host backend: a CE, mode or Tx FIFO change
+// right after it, even with the pulse still deferred by the power up, is
+// held until the payload is on air and never waits for it; flush_tx()
+// aborts the pulse.
+
+#include "host/tests/test_support.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define STATUS_TX_DS		0x20
+
+enum class Action {
+	CE_LOW,
+	RECEIVER_MODE,
+	START_LISTENING,
+	START_LISTENING_ENGINE,
+	FLUSH_TX
+};
+
+void run(EventQueue &queue, uint32_t duration)
+{
+	for (uint32_t elapsed = 0; elapsed < duration; elapsed += 100) {
+		wait_us(100);
+		queue.dispatch_once();
+	}
+}
+
+// the receiver listens, the transmitter is just powered up or already ready
+void test_pulse(Action action, bool powering_up)
+{
+	Air air;
+	SPI tx_spi(NC, NC, NC);
+	SPI rx_spi(NC, NC, NC);
+	Radio tx_chip(air, tx_spi, 1, 2, 3);
+	Radio rx_chip(air, rx_spi, 11, 12, 13);
+	NRF24L01 tx(&tx_spi, 1, 2, 3);
+	NRF24L01 rx(&rx_spi, 11, 12, 13);
+	NRF24L01::Configuration configuration;
+	EventQueue queue;
+	uint8_t payload[32] = {0};
+	uint64_t bytes = 0;
+
+	tx_spi.frequency(SPI_FREQUENCY);
+	rx_spi.frequency(SPI_FREQUENCY);
+	configuration.auto_acknowledgement = true;
+	configuration.mode = NRF24L01::OperationMode::RECEIVER;
+	rx.initialize(NRF24L01::register_image(configuration));
+	rx.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	tx.initialize(NRF24L01::register_image(configuration));
+	if (action == Action::START_LISTENING_ENGINE) {
+		tx.start_rx_engine(&queue);
+		queue.dispatch_once();
+	}
+	if (!powering_up) {
+		wait_us(Radio::POWER_UP_DELAY);
+	}
+
+	tx.send_packet(payload, sizeof(payload));
+	bytes = tx_spi.clocked_bytes();
+	switch (action) {
+		case Action::CE_LOW:
+			tx.set_com_ce(0);
+			break;
+		case Action::RECEIVER_MODE:
+			tx.set_mode(NRF24L01::OperationMode::RECEIVER);
+			break;
+		case Action::START_LISTENING:
+		case Action::START_LISTENING_ENGINE:
+			tx.set_mode(NRF24L01::OperationMode::RECEIVER);
+			tx.start_listening();
+			break;
+		case Action::FLUSH_TX:
+			tx.flush_tx();
+			// a single FLUSH_TX: dropped at once, CE low
+			CHECK(tx_spi.clocked_bytes() - bytes == 1);
+			CHECK(!tx.com_ce());
+			CHECK(tx.statistics().tx_dropped == 1);
+			CHECK(tx_chip.tx_fifo_level() == 0);
+			break;
+	}
+	if (action != Action::FLUSH_TX) {
+		// held, not waited for: only FLUSH_RX hits the bus
+		CHECK(tx_spi.clocked_bytes() - bytes
+				== ((action == Action::CE_LOW || action == Action::RECEIVER_MODE) ? 0 : 1));
+	}
+	run(queue, Radio::POWER_UP_DELAY + 1000);
+
+	switch (action) {
+		case Action::CE_LOW:
+			CHECK(!tx.com_ce());
+			break;
+		case Action::RECEIVER_MODE:
+			// written before the next transaction
+			CHECK(tx.config_status_register(true) & 0x01);
+			break;
+		case Action::START_LISTENING:
+			// the outcome is seen when the application clears the flags
+			CHECK(!tx.com_ce());
+			CHECK(tx.status_register() & STATUS_TX_DS);
+			tx.clear_interrupt_flags();
+			CHECK(tx.com_ce());
+			break;
+		case Action::START_LISTENING_ENGINE:
+			// the outcome is seen by the engine
+			CHECK(tx.com_ce());
+			CHECK(tx.config_status_register() & 0x01);
+			break;
+		case Action::FLUSH_TX:
+			break;
+	}
+
+	CHECK(rx_chip.rx_fifo_level() == ((action == Action::FLUSH_TX) ? 0 : 1));
+	CHECK(tx_chip.tx_fifo_level() == 0);
+	CHECK(tx.statistics().tx_dropped == ((action == Action::FLUSH_TX) ? 1 : 0));
+}
+}
+
+int main(void)
+{
+	test_pulse(Action::CE_LOW, true);
+	test_pulse(Action::CE_LOW, false);
+	test_pulse(Action::RECEIVER_MODE, true);
+	test_pulse(Action::START_LISTENING, true);
+	test_pulse(Action::START_LISTENING, false);
+	test_pulse(Action::START_LISTENING_ENGINE, true);
+	test_pulse(Action::FLUSH_TX, true);
+	test_pulse(Action::FLUSH_TX, false);
+
+	return test_result("ce_pulse");
+}
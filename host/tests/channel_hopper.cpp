@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Channel hopper on the host backend: the hop sequence is a permutation of
+// the valid channels set by the seed, timed hops follow the dwell time on
+// the virtual clock without drifting, and a parked receiver realigns its
+// hops on the packet of its peer.
+
+#include "host/tests/test_support.h"
+#include "nrf24l01/channel_hopper.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define DISPATCH_PERIOD		10 // in µs
+#define DWELL_TIME			2000 // in µs
+#define HOP_COUNT			20
+#define HOP_LATENCY			20 // in µs, event loop and RF_CH write
+#define SYNC_OFFSET			300 // in µs, peer hop to packet timestamp
+#define REG_RF_CH			0x05
+
+// the radio of the transmitter is left on its own, its chip tells the
+// channel actually written
+void test_sequence(void)
+{
+	Link link;
+	ChannelHopper hopper(&link.tx, &link.tx_queue);
+	ChannelHopper peer(&link.rx, &link.rx_queue);
+	const uint8_t channels[] = {10, 200, 20, 30, 126, 40, 125};
+	bool seen[ChannelHopper::MAX_CHANNELS] = {false};
+	bool reordered = false;
+
+	// out of range channels are left out
+	CHECK(hopper.set_sequence(channels, sizeof(channels), 1234) == 5);
+	CHECK(peer.set_sequence(channels, sizeof(channels), 1234) == 5);
+	for (uint8_t i = 0; i < 5; i++) {
+		CHECK(hopper.channel(i) == peer.channel(i));
+		CHECK(!seen[hopper.channel(i)]);
+		seen[hopper.channel(i)] = true;
+	}
+	CHECK(seen[10] && seen[20] && seen[30] && seen[40] && seen[125]);
+
+	// another seed, another order
+	CHECK(peer.set_sequence(channels, sizeof(channels), 4321) == 5);
+	for (uint8_t i = 0; i < 5; i++) {
+		reordered = reordered || (hopper.channel(i) != peer.channel(i));
+	}
+	CHECK(reordered);
+
+	// hop() walks the sequence and wraps around
+	for (uint8_t i = 1; i <= 6; i++) {
+		hopper.hop();
+		CHECK(hopper.index() == i % 5);
+		CHECK(link.tx_chip.register_value(REG_RF_CH) == hopper.channel(i));
+		CHECK(link.tx.rf_frequency() == NRF24L01::MIN_RF_FREQUENCY + hopper.channel(i));
+	}
+	CHECK(hopper.hops() == 6);
+
+	// ranges stop at channel 125
+	CHECK(hopper.set_sequence(100, 200, 1) == 26);
+	CHECK(hopper.set_sequence(30, 20, 1) == 0);
+}
+
+// the hops are due every dwell time from start(), each on the next channel
+void test_timed_hops(void)
+{
+	Link link;
+	ChannelHopper hopper(&link.tx, &link.tx_queue);
+	uint32_t times[HOP_COUNT + 1];
+	uint8_t channels[HOP_COUNT + 1];
+	uint8_t count = 0;
+	uint32_t elapsed = 0;
+	uint32_t due = 0;
+
+	CHECK(hopper.set_sequence(2, 80, 42) == 79);
+	hopper.attach([&](uint8_t channel) {
+		if (count <= HOP_COUNT) {
+			times[count] = us_ticker_read();
+			channels[count] = link.tx_chip.register_value(REG_RF_CH);
+		}
+		CHECK(channel == link.tx_chip.register_value(REG_RF_CH));
+		count++;
+	});
+
+	// the first hop is on the spot
+	hopper.start(DWELL_TIME);
+	CHECK(count == 1);
+	CHECK(link.tx.active_engines() == NRF24L01::ENGINE_HOPPER);
+	link.run(HOP_COUNT * DWELL_TIME + DWELL_TIME / 2, DISPATCH_PERIOD);
+	CHECK(count == HOP_COUNT + 1);
+
+	// absolute targets: the latency does not pile up over the hops
+	for (uint8_t i = 0; i <= HOP_COUNT; i++) {
+		elapsed = times[i] - times[0];
+		due = i * DWELL_TIME;
+		CHECK(channels[i] == hopper.channel(i));
+		CHECK((elapsed >= due) && (elapsed < due + HOP_LATENCY));
+	}
+
+	hopper.stop();
+	CHECK(link.tx.active_engines() == 0);
+	link.run(2 * DWELL_TIME, DISPATCH_PERIOD);
+	CHECK(count == HOP_COUNT + 1);
+	CHECK(hopper.hops() == HOP_COUNT + 1);
+}
+
+// a receiver parked on the sixth channel of the sequence gets a packet sent
+// 2.5 dwell times after its peer hopped there: it catches up two channels
+// and its next hop is the one of its peer
+void test_synchronize(void)
+{
+	Link link;
+	ChannelHopper hopper(&link.rx, &link.rx_queue);
+	uint32_t peer_hop = 0;
+	uint32_t hop_time = 0;
+
+	CHECK(hopper.set_sequence(1, 80, 7) == 80);
+	hopper.set_sync_offset(SYNC_OFFSET);
+	hopper.attach([&](uint8_t) {
+		hop_time = us_ticker_read();
+	});
+	hopper.park(DWELL_TIME);
+	hopper.hop_to(5);
+
+	peer_hop = us_ticker_read() - 2 * DWELL_TIME - DWELL_TIME / 2;
+	CHECK(hopper.synchronize(peer_hop + SYNC_OFFSET));
+	CHECK(hopper.index() == 7);
+	CHECK(link.rx_chip.register_value(REG_RF_CH) == hopper.channel(7));
+	CHECK(link.rx.active_engines() == NRF24L01::ENGINE_HOPPER);
+
+	link.run(DWELL_TIME / 2 + HOP_LATENCY, DISPATCH_PERIOD);
+	CHECK(hopper.index() == 8);
+	CHECK(link.rx_chip.register_value(REG_RF_CH) == hopper.channel(8));
+	CHECK((hop_time - peer_hop >= 3 * DWELL_TIME) && (hop_time - peer_hop < 3 * DWELL_TIME + HOP_LATENCY));
+	hopper.stop();
+
+	// out of the sequence, the receiver stays parked
+	link.rx.hop(100);
+	CHECK(!hopper.synchronize(us_ticker_read()));
+	CHECK(link.rx.active_engines() == 0);
+}
+}
+
+int main(void)
+{
+	test_sequence();
+	test_timed_hops();
+	test_synchronize();
+
+	return test_result("channel_hopper");
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Channel survey on the host backend, with carriers simulated by the
+// interference of the air: the occupancy counts follow the carriers, the
+// link channel is restored or moved to the cleanest one, the radio is woken
+// up before the first sample, and the survey neither counts in the link
+// statistics nor runs under an active engine.
+
+#include "host/tests/test_support.h"
+#include "nrf24l01/channel_hopper.h"
+#include "nrf24l01/channel_survey.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define PASSES				20
+#define BUSY_CHANNEL		40 // a carrier all the time
+#define SHARED_CHANNEL		60 // a carrier half of the time
+#define RPD_DWELL_TIME		170 // in µs, see ChannelSurvey::scan()
+#define LINK_FREQUENCY		2402 // in MHz, default of the register image
+
+void test_occupancy(void)
+{
+	Link link;
+	ChannelSurvey survey(&link.tx);
+	uint8_t channels[ChannelSurvey::CHANNEL_COUNT];
+	uint32_t sweep_time = 0;
+
+	link.air.set_interference(BUSY_CHANNEL, 1.0);
+	link.air.set_interference(SHARED_CHANNEL, 0.5);
+
+	sweep_time = survey.scan(PASSES);
+	CHECK(sweep_time >= PASSES * ChannelSurvey::CHANNEL_COUNT * RPD_DWELL_TIME);
+	CHECK(survey.sweep_time() == sweep_time);
+	CHECK(survey.passes() == PASSES);
+	for (uint8_t channel = 0; channel < ChannelSurvey::CHANNEL_COUNT; channel++) {
+		if (channel == BUSY_CHANNEL) {
+			CHECK(survey.occupancy(channel) == PASSES);
+		} else if (channel == SHARED_CHANNEL) {
+			CHECK((survey.occupancy(channel) > 0) && (survey.occupancy(channel) < PASSES));
+		} else {
+			CHECK(survey.occupancy(channel) == 0);
+		}
+	}
+
+	// the busy channel ranks last, its neighbours are not the cleanest
+	CHECK(survey.ranked_channels(channels, ChannelSurvey::CHANNEL_COUNT) == ChannelSurvey::CHANNEL_COUNT);
+	CHECK(channels[ChannelSurvey::CHANNEL_COUNT - 1] == BUSY_CHANNEL);
+	CHECK(survey.best_channel() == channels[0]);
+	CHECK(survey.occupancy(survey.best_channel()) == 0);
+	CHECK((survey.best_channel() < BUSY_CHANNEL - 1) || (survey.best_channel() > BUSY_CHANNEL + 1));
+
+	// the link is back on its channel and mode, its statistics untouched
+	CHECK(link.tx.rf_frequency() == LINK_FREQUENCY);
+	CHECK(link.tx.mode() == NRF24L01::OperationMode::TRANSCEIVER);
+	CHECK(link.tx.com_ce() == 0);
+	CHECK(link.tx.statistics().rpd_hits == 0);
+
+	// or moved to the cleanest channel
+	survey.reset();
+	survey.set_auto_select(true);
+	survey.scan(1, BUSY_CHANNEL - 1, BUSY_CHANNEL + 2);
+	CHECK(survey.best_channel() == BUSY_CHANNEL + 2);
+	CHECK(link.tx.rf_frequency() == NRF24L01::MIN_RF_FREQUENCY + BUSY_CHANNEL + 2);
+	CHECK(link.tx_chip.register_value(0x05) == BUSY_CHANNEL + 2);
+}
+
+// from power down, the first sample waits for the power up and settling
+void test_power_up(void)
+{
+	Link link;
+	ChannelSurvey survey(&link.tx);
+
+	link.air.set_interference(BUSY_CHANNEL, 1.0);
+	link.tx.power_down();
+
+	CHECK(survey.scan(1, BUSY_CHANNEL, BUSY_CHANNEL) >= Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+	CHECK(survey.occupancy(BUSY_CHANNEL) == 1);
+	CHECK(link.tx.mode() == NRF24L01::OperationMode::POWER_DOWN);
+	CHECK(link.tx_chip.state() == Radio::State::POWER_DOWN);
+}
+
+// a Tx stream or a timed hopper keeps the radio: no scan, no radio access
+void test_active_engines(void)
+{
+	Link link;
+	ChannelSurvey survey(&link.tx);
+	ChannelHopper hopper(&link.tx, &link.tx_queue);
+	uint32_t transactions = 0;
+
+	link.air.set_interference(BUSY_CHANNEL, 1.0);
+
+	link.tx.start_tx_stream(&link.tx_queue);
+	transactions = link.tx.statistics().spi_transactions;
+	CHECK(survey.scan() == 0);
+	CHECK(survey.passes() == 0);
+	CHECK(link.tx.statistics().spi_transactions == transactions);
+	link.tx.stop_tx_stream();
+
+	hopper.set_sequence(1, 10, 1);
+	hopper.start(10000);
+	CHECK(survey.scan() == 0);
+	CHECK(survey.passes() == 0);
+	hopper.stop();
+
+	CHECK(survey.scan() > 0);
+	CHECK(survey.passes() == 1);
+	CHECK(survey.occupancy(BUSY_CHANNEL) == 1);
+}
+}
+
+int main(void)
+{
+	test_occupancy();
+	test_power_up();
+	test_active_engines();
+
+	return test_result("channel_survey");
+}
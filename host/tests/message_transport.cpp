@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Message transport on the host backend, 2 Mbps link: a message is
+// reassembled in order, a fragment lost past the auto retransmissions is
+// the only one sent again, and a message larger than the receiver buffer
+// is never acknowledged.
+
+#include "host/tests/test_support.h"
+#include "nrf24l01/message_transport.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define RECEIVER_ADDRESS	0xC2C2C2C2C2 // Rx pipe 1 reset address
+#define RETRANSMIT_COUNT	3
+#define MESSAGE_SIZE		20000 // in bytes
+#define LOST_FRAGMENT		5
+#define GUARD_SIZE			64 // in bytes
+#define DISPATCH_PERIOD		10 // in µs
+#define SEND_TIMEOUT		20000000 // in µs
+#define MIN_GOODPUT			600000 // in bit/s
+
+uint8_t message[MESSAGE_SIZE];
+uint8_t received[MESSAGE_SIZE + GUARD_SIZE];
+
+NRF24L01::Configuration transport_configuration(void)
+{
+	NRF24L01::Configuration configuration = link_configuration();
+
+	configuration.dynamic_payload = true;
+	configuration.retransmit_count = RETRANSMIT_COUNT;
+
+	return configuration;
+}
+
+// a sender and a receiver on the link
+class TransportLink: public Link {
+public:
+	TransportLink(void):
+			Link(transport_configuration()), sender(&tx, &tx_queue), receiver(&rx, &rx_queue)
+	{
+		uint8_t address[5];
+
+		for (uint8_t i = 0; i < 5; i++) {
+			address[i] = (static_cast<uint64_t>(RECEIVER_ADDRESS) >> (8 * i)) & 0xFF;
+		}
+		tx.set_tx_address(address);
+	}
+
+	// true once delivered, false once given up
+	bool send(uint32_t length, uint32_t capacity, uint32_t *received_length)
+	{
+		uint32_t start = us_ticker_read();
+		int delivered = -1;
+
+		receiver.listen(received, capacity, [received_length](uint32_t length) {
+			*received_length = length;
+		});
+		CHECK(sender.send(message, length, [&delivered](bool success) {
+			delivered = success;
+		}));
+		while ((delivered < 0) && ((us_ticker_read() - start) < SEND_TIMEOUT)) {
+			run(DISPATCH_PERIOD, DISPATCH_PERIOD);
+		}
+		CHECK(delivered >= 0);
+
+		return (delivered > 0);
+	}
+
+	MessageTransport sender;
+	MessageTransport receiver;
+};
+
+void prepare(void)
+{
+	srand(1);
+	for (uint32_t i = 0; i < MESSAGE_SIZE; i++) {
+		message[i] = rand();
+	}
+	memset(received, 0, sizeof(received));
+}
+
+uint32_t fragment_count(uint32_t length)
+{
+	return (length + MessageTransport::FRAGMENT_SIZE - 1) / MessageTransport::FRAGMENT_SIZE;
+}
+
+// no loss: every fragment once, in order, at the link goodput
+void test_in_order(void)
+{
+	TransportLink link;
+	uint32_t length = 0;
+
+	prepare();
+	CHECK(link.send(MESSAGE_SIZE, MESSAGE_SIZE, &length));
+	CHECK(length == MESSAGE_SIZE);
+	CHECK(memcmp(received, message, MESSAGE_SIZE) == 0);
+
+	CHECK(link.sender.statistics().messages_sent == 1);
+	CHECK(link.sender.statistics().fragments_sent == fragment_count(MESSAGE_SIZE));
+	CHECK(link.sender.statistics().fragments_retransmitted == 0);
+	CHECK(link.sender.statistics().goodput > MIN_GOODPUT);
+	CHECK(link.receiver.statistics().messages_received == 1);
+	CHECK(link.receiver.statistics().fragments_received == fragment_count(MESSAGE_SIZE));
+	CHECK(link.receiver.statistics().fragments_duplicated == 0);
+}
+
+// every copy of one fragment is lost until the sender MAX_RT
+void test_lost_fragment(void)
+{
+	TransportLink link;
+	uint32_t length = 0;
+	uint8_t lost = 0;
+
+	link.air.set_filter([&lost](const Frame &frame) {
+		uint16_t index = frame.payload[1] | (frame.payload[2] << 8);
+
+		if (frame.ack || (frame.length <= MessageTransport::HEADER_SIZE) || (frame.payload[0] & 0xC0)
+				|| (index != LOST_FRAGMENT) || (lost > RETRANSMIT_COUNT)) {
+			return false;
+		}
+		lost++;
+
+		return true;
+	});
+
+	prepare();
+	CHECK(link.send(MESSAGE_SIZE, MESSAGE_SIZE, &length));
+	CHECK(lost == RETRANSMIT_COUNT + 1);
+	CHECK(length == MESSAGE_SIZE);
+	CHECK(memcmp(received, message, MESSAGE_SIZE) == 0);
+
+	CHECK(link.sender.statistics().fragments_retransmitted == 1);
+	CHECK(link.sender.statistics().fragments_sent == fragment_count(MESSAGE_SIZE) + 1);
+	CHECK(link.receiver.statistics().fragments_received == fragment_count(MESSAGE_SIZE));
+}
+
+// the fragments past the receiver buffer are dropped, the sender gives up
+void test_buffer_too_small(void)
+{
+	TransportLink link;
+	uint32_t length = 0;
+	uint32_t capacity = MESSAGE_SIZE / 2;
+
+	prepare();
+	CHECK(!link.send(MESSAGE_SIZE, capacity, &length));
+	CHECK(length == 0);
+	CHECK(link.sender.statistics().messages_failed == 1);
+	CHECK(link.receiver.statistics().messages_received == 0);
+	CHECK(memcmp(received, message, capacity - (capacity % MessageTransport::FRAGMENT_SIZE)) == 0);
+	for (uint32_t i = capacity; i < sizeof(received); i++) {
+		CHECK(received[i] == 0);
+	}
+
+	// the transport is usable again
+	prepare();
+	CHECK(link.send(1000, capacity, &length));
+	CHECK(length == 1000);
+	CHECK(memcmp(received, message, 1000) == 0);
+}
+}
+
+int main(void)
+{
+	test_in_order();
+	test_lost_fragment();
+	test_buffer_too_small();
+
+	return test_result("message_transport");
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Packet pool ownership on the host backend: a buffer released twice is
+// linked once in the free list, a stale handle is rejected once its buffer
+// is allocated again, and the driver only queues handles of allocated and
+// filled buffers.
+
+#include "host/tests/test_support.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define POOL_SIZE			4
+
+// a double release neither underflows in_use nor hands a buffer out twice
+void test_double_release(void)
+{
+	PacketPool::Buffer buffers[POOL_SIZE];
+	PacketPool pool(buffers, POOL_SIZE);
+	PacketPool::Handle a = pool.allocate();
+	PacketPool::Handle b = PacketPool::INVALID_HANDLE;
+	PacketPool::Handle c = PacketPool::INVALID_HANDLE;
+
+	pool.release(a);
+	pool.release(a);
+	CHECK(pool.statistics().in_use == 0);
+	CHECK(pool.available() == POOL_SIZE);
+	CHECK(pool.payload(a) == NULL);
+
+	b = pool.allocate();
+	c = pool.allocate();
+	CHECK(b != PacketPool::INVALID_HANDLE);
+	CHECK(c != PacketPool::INVALID_HANDLE);
+	CHECK(b != c);
+	CHECK(pool.statistics().in_use == 2);
+
+	// every buffer is handed out once
+	CHECK(pool.allocate() != PacketPool::INVALID_HANDLE);
+	CHECK(pool.allocate() != PacketPool::INVALID_HANDLE);
+	CHECK(pool.allocate() == PacketPool::INVALID_HANDLE);
+	CHECK(pool.statistics().in_use == POOL_SIZE);
+}
+
+// the handle of a released buffer allocated again is neither released nor
+// sent in place of the new one
+void test_stale_handle(void)
+{
+	Air air;
+	SPI spi(NC, NC, NC);
+	Radio chip(air, spi, 1, 2, 3);
+	NRF24L01 radio(&spi, 1, 2, 3);
+	PacketPool::Buffer buffers[POOL_SIZE];
+	PacketPool pool(buffers, POOL_SIZE);
+	PacketPool::Handle stale = pool.allocate();
+	PacketPool::Handle handle = PacketPool::INVALID_HANDLE;
+	NRF24L01::Configuration configuration;
+
+	spi.frequency(SPI_FREQUENCY);
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	radio.initialize(NRF24L01::register_image(configuration));
+	radio.set_packet_pool(&pool);
+	wait_us(Radio::POWER_UP_DELAY);
+
+	pool.release(stale);
+	handle = pool.allocate();
+	pool.set_length(handle, 8);
+	// same buffer, new generation
+	CHECK((handle & 0xFF) == (stale & 0xFF));
+	CHECK(handle != stale);
+	CHECK(pool.payload(stale) == NULL);
+	CHECK(pool.length(stale) == 0);
+
+	pool.release(stale);
+	CHECK(pool.statistics().in_use == 1);
+	CHECK(!radio.queue_packet(stale));
+	radio.send_packet(stale);
+	CHECK(chip.tx_fifo_level() == 0);
+	CHECK(pool.payload(handle) != NULL);
+}
+
+// invalid, out of range, free and empty handles are rejected by the Tx paths
+void test_queue_invalid_handles(void)
+{
+	Air air;
+	SPI spi(NC, NC, NC);
+	Radio chip(air, spi, 1, 2, 3);
+	NRF24L01 radio(&spi, 1, 2, 3);
+	PacketPool::Buffer buffers[POOL_SIZE];
+	PacketPool pool(buffers, POOL_SIZE);
+	PacketPool::Handle freed = PacketPool::INVALID_HANDLE;
+	PacketPool::Handle handle = PacketPool::INVALID_HANDLE;
+	NRF24L01::Configuration configuration;
+
+	spi.frequency(SPI_FREQUENCY);
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	radio.initialize(NRF24L01::register_image(configuration));
+	wait_us(Radio::POWER_UP_DELAY);
+
+	// no pool attached yet
+	handle = pool.allocate();
+	CHECK(!radio.queue_packet(handle));
+
+	radio.set_packet_pool(&pool);
+	freed = pool.allocate();
+	pool.release(freed);
+	CHECK(!radio.queue_packet(PacketPool::INVALID_HANDLE));
+	CHECK(!radio.queue_packet(POOL_SIZE));
+	CHECK(!radio.queue_packet(freed));
+	CHECK(radio.tx_pending() == 0);
+
+	radio.send_packet(POOL_SIZE);
+	radio.send_packet(freed);
+	CHECK(chip.tx_fifo_level() == 0);
+
+	// no empty payload
+	pool.set_length(handle, 0);
+	CHECK(!radio.queue_packet(handle));
+	radio.send_packet(handle);
+	CHECK(!radio.queue_packet(buffers, 0));
+	CHECK(chip.tx_fifo_level() == 0);
+
+	pool.set_length(handle, 8);
+	CHECK(radio.queue_packet(handle));
+	CHECK(radio.tx_pending() == 1);
+}
+}
+
+int main(void)
+{
+	test_double_release();
+	test_stale_handle();
+	test_queue_invalid_handles();
+
+	return test_result("packet_pool");
+}
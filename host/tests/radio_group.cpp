@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Radio group on the host backend, radios sharing one SPI bus: transfers
+// deferred while the bus is held are started again by its release, highest
+// priority first, and the IRQs of the radios are serviced by the group
+// dispatcher in priority order.
+
+#include "host/tests/test_support.h"
+#include "nrf24l01/radio_group.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define RX_ADDRESS			0xB3B4B5B6B7
+#define LOW_PRIORITY		5
+#define HIGH_PRIORITY		1
+
+// the order in which the radios called back, by name
+struct Log {
+	char names[4];
+	uint8_t count;
+
+	void add(char name)
+	{
+		if (count < sizeof(names)) {
+			names[count] = name;
+		}
+		count++;
+	}
+};
+
+NRF24L01::RegisterImage image(NRF24L01::OperationMode mode, uint16_t rf_frequency)
+{
+	NRF24L01::Configuration configuration;
+
+	configuration.mode = mode;
+	configuration.rf_frequency = rf_frequency;
+	configuration.tx_address = RX_ADDRESS;
+	configuration.rx_address = RX_ADDRESS;
+
+	return NRF24L01::register_image(configuration);
+}
+
+// a holds the bus with its transfer, b then c are deferred: c, of higher
+// priority, is started first by the release of a, then b by the one of c
+void test_deferred_restart(void)
+{
+	Air air;
+	SPI bus(NC, NC, NC);
+	SPI rx_spi(NC, NC, NC);
+	EventQueue queue;
+	Radio chip_a(air, bus, 21, 22, 23);
+	Radio chip_b(air, bus, 31, 32, 33);
+	Radio chip_c(air, bus, 41, 42, 43);
+	Radio rx_chip(air, rx_spi, 51, 52, 53);
+	RadioGroup group(&bus, &queue);
+	NRF24L01 a(&group, 21, 22, 23, LOW_PRIORITY);
+	NRF24L01 b(&group, 31, 32, 33, LOW_PRIORITY);
+	NRF24L01 c(&group, 41, 42, 43, HIGH_PRIORITY);
+	NRF24L01 rx(&rx_spi, 51, 52, 53);
+	Log sent = {{0}, 0};
+	uint8_t payload[32];
+	uint8_t received[32];
+
+	bus.frequency(SPI_FREQUENCY);
+	rx_spi.frequency(SPI_FREQUENCY);
+	CHECK(group.radio_count() == 3);
+	a.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2420));
+	b.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2440));
+	c.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2460));
+	rx.initialize(image(NRF24L01::OperationMode::RECEIVER, 2440));
+	rx.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+
+	memset(payload, 0xA5, sizeof(payload));
+	CHECK(a.send_packet_async(payload, 32, [&](int) { sent.add('a'); }));
+	CHECK(b.send_packet_async(payload, 32, [&](int) { sent.add('b'); }));
+	CHECK(c.send_packet_async(payload, 32, [&](int) { sent.add('c'); }));
+
+	// the deferred radios are neither selected nor loaded yet
+	CHECK(!Pins::read(21));
+	CHECK(Pins::read(31));
+	CHECK(Pins::read(41));
+	CHECK(b.statistics().tx_packets == 0);
+	CHECK(c.statistics().tx_packets == 0);
+
+	wait_us(2000);
+	CHECK(sent.count == 3);
+	CHECK((sent.names[0] == 'a') && (sent.names[1] == 'c') && (sent.names[2] == 'b'));
+	CHECK(b.statistics().tx_packets == 1);
+	CHECK(c.statistics().tx_packets == 1);
+	CHECK(Pins::read(21) && Pins::read(31) && Pins::read(41));
+
+	// and the payload of b went out intact
+	CHECK(rx.read_packet(received) == 32);
+	CHECK(memcmp(received, payload, 32) == 0);
+}
+
+// both grouped receivers get a packet, the low priority one first: the
+// dispatcher still services the high priority radio first
+void test_dispatch_priority(void)
+{
+	Air air;
+	SPI bus(NC, NC, NC);
+	SPI tx_spi(NC, NC, NC);
+	EventQueue queue;
+	EventQueue tx_queue;
+	Radio chip_low(air, bus, 21, 22, 23);
+	Radio chip_high(air, bus, 31, 32, 33);
+	Radio tx_chip(air, tx_spi, 41, 42, 43);
+	RadioGroup group(&bus, &queue);
+	NRF24L01 low(&group, 21, 22, 23, LOW_PRIORITY);
+	NRF24L01 high(&group, 31, 32, 33, HIGH_PRIORITY);
+	NRF24L01 tx(&tx_spi, 41, 42, 43);
+	Log received = {{0}, 0};
+	uint8_t payload[32] = {0};
+
+	bus.frequency(SPI_FREQUENCY);
+	tx_spi.frequency(SPI_FREQUENCY);
+	low.initialize(image(NRF24L01::OperationMode::RECEIVER, 2420));
+	high.initialize(image(NRF24L01::OperationMode::RECEIVER, 2460));
+	tx.initialize(image(NRF24L01::OperationMode::TRANSCEIVER, 2420));
+	low.set_com_ce(1);
+	high.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+
+	// the queue given to the engines is the one of the group
+	low.start_rx_engine(&tx_queue, [&]() { received.add('l'); });
+	high.start_rx_engine(&tx_queue, [&]() { received.add('h'); });
+	queue.dispatch_once();
+	CHECK(tx_queue.pending() == 0);
+
+	tx.send_packet(payload, sizeof(payload));
+	wait_us(1000);
+	tx.hop(60);
+	tx.send_packet(payload, sizeof(payload));
+	wait_us(1000);
+	CHECK(received.count == 0);
+
+	queue.dispatch_once();
+	CHECK(received.count == 2);
+	CHECK((received.names[0] == 'h') && (received.names[1] == 'l'));
+	CHECK(low.rx_available() == 1);
+	CHECK(high.rx_available() == 1);
+	CHECK(chip_low.rx_fifo_level() == 0);
+	CHECK(chip_high.rx_fifo_level() == 0);
+}
+}
+
+int main(void)
+{
+	test_deferred_restart();
+	test_dispatch_priority();
+
+	return test_result("radio_group");
+}
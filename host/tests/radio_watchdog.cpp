@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Radio watchdog on the host backend, Tx stream to an Rx engine: a supply
+// dip of either radio and a lost IRQ edge of the transmitter are each
+// recovered by a single burst, within a bounded SPI cost and time, and the
+// stream goes on.
+
+#include "host/tests/test_support.h"
+#include "nrf24l01/radio_watchdog.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define TX_CHIP_IRQ			3 // bridged to the driver IRQ pin, see WatchdogLink
+#define TX_DRIVER_IRQ		4
+#define CHECK_PERIOD		5000 // in µs
+#define LOOP_PERIOD			100 // in µs
+#define RUN_TIME			50000 // in µs, several checks
+#define TX_RESET_COST		9 // SPI transactions, registers away from reset
+#define RX_RESET_COST		3
+#define RESET_DURATION		1700 // in µs, power up and settling included
+#define IRQ_DURATION		200 // in µs
+
+// a transmitter streaming to a receiver, each under its own watchdog
+class WatchdogLink: public Link {
+public:
+	WatchdogLink(void):
+			Link(link_configuration(), TX_DRIVER_IRQ),
+			tx_watchdog(&tx, &tx_queue), rx_watchdog(&rx, &rx_queue),
+			tx_recoveries(0), rx_recoveries(0), received(0), lose_irq_edge(false)
+	{
+		// a falling edge of the transmitter IRQ line can be lost on its way
+		Pins::listen(TX_CHIP_IRQ, this, [this](int level) {
+			if (!level && lose_irq_edge) {
+				lose_irq_edge = false;
+				return;
+			}
+			Pins::write(TX_DRIVER_IRQ, level);
+		});
+
+		rx.start_rx_engine(&rx_queue);
+		tx.start_tx_stream(&tx_queue);
+		tx_watchdog.attach([this](const RadioWatchdog::Recovery &recovery) {
+			tx_recovery = recovery;
+			tx_recoveries++;
+		});
+		rx_watchdog.attach([this](const RadioWatchdog::Recovery &recovery) {
+			rx_recovery = recovery;
+			rx_recoveries++;
+		});
+		tx_watchdog.start(CHECK_PERIOD);
+		rx_watchdog.start(CHECK_PERIOD);
+	}
+
+	~WatchdogLink()
+	{
+		Pins::unlisten(TX_CHIP_IRQ, this);
+	}
+
+	// both MCU event loops, the Tx stream kept loaded
+	void run(uint32_t duration)
+	{
+		uint8_t payload[32] = {0};
+		NRF24L01::RxPacket packet;
+
+		for (uint32_t elapsed = 0; elapsed < duration; elapsed += LOOP_PERIOD) {
+			tx.queue_packet(payload, sizeof(payload));
+			Link::run(LOOP_PERIOD, LOOP_PERIOD);
+			while (rx.receive(&packet)) {
+				received++;
+			}
+		}
+	}
+
+	RadioWatchdog tx_watchdog;
+	RadioWatchdog rx_watchdog;
+	RadioWatchdog::Recovery tx_recovery;
+	RadioWatchdog::Recovery rx_recovery;
+	uint32_t tx_recoveries;
+	uint32_t rx_recoveries;
+	uint32_t received;
+	bool lose_irq_edge;
+};
+
+// no fault, no recovery
+void test_healthy(void)
+{
+	WatchdogLink link;
+
+	link.run(RUN_TIME);
+	CHECK(link.received > 0);
+	CHECK(link.tx_recoveries == 0);
+	CHECK(link.rx_recoveries == 0);
+	CHECK(link.tx_watchdog.statistics().checks >= RUN_TIME / CHECK_PERIOD - 1);
+}
+
+// the transmitter is reset mid-stream
+void test_transmitter_reset(void)
+{
+	WatchdogLink link;
+	uint32_t received = 0;
+
+	link.run(RUN_TIME);
+	link.tx_chip.brownout();
+	link.run(RUN_TIME);
+	CHECK(link.tx_recoveries == 1);
+	CHECK(link.rx_recoveries == 0);
+	CHECK(link.tx_recovery.faults == NRF24L01::FAULT_CONFIG);
+	CHECK(link.tx_recovery.spi_transactions <= TX_RESET_COST);
+	CHECK(link.tx_recovery.duration < RESET_DURATION);
+
+	received = link.received;
+	link.run(RUN_TIME);
+	CHECK(link.received > received);
+}
+
+// the receiver is reset
+void test_receiver_reset(void)
+{
+	WatchdogLink link;
+	uint32_t received = 0;
+
+	link.run(RUN_TIME);
+	link.rx_chip.brownout();
+	link.run(RUN_TIME);
+	CHECK(link.rx_recoveries == 1);
+	CHECK(link.rx_recovery.faults == NRF24L01::FAULT_CONFIG);
+	CHECK(link.rx_recovery.spi_transactions <= RX_RESET_COST);
+	CHECK(link.rx_recovery.duration < RESET_DURATION);
+
+	received = link.received;
+	link.run(RUN_TIME);
+	CHECK(link.received > received);
+}
+
+// the transmitter misses a falling edge of its IRQ line, which stays low
+void test_lost_irq_edge(void)
+{
+	WatchdogLink link;
+	uint32_t received = 0;
+
+	link.run(RUN_TIME);
+	link.lose_irq_edge = true;
+	link.run(RUN_TIME);
+	CHECK(!link.lose_irq_edge);
+	CHECK(link.tx_recoveries == 1);
+	CHECK(link.tx_recovery.faults == NRF24L01::FAULT_IRQ);
+	CHECK(link.tx_recovery.duration < IRQ_DURATION);
+
+	received = link.received;
+	link.run(RUN_TIME);
+	CHECK(link.received > received);
+}
+}
+
+int main(void)
+{
+	test_healthy();
+	test_transmitter_reset();
+	test_receiver_reset();
+	test_lost_irq_edge();
+
+	return test_result("radio_watchdog");
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Multi-pipe receive on the host backend: each pipe with a static payload
+// width is read with its own RX_PW_Px width, whatever the width of the
+// pipe configured last.
+
+#include "host/tests/test_support.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define PIPE_0_ADDRESS		0xE7E7E7E7E7
+#define PIPE_1_ADDRESS		0xC2C2C2C2C2
+
+void send(NRF24L01 &tx, uint64_t address, const uint8_t *payload, uint8_t length)
+{
+	uint8_t tx_address[5];
+
+	for (uint8_t i = 0; i < 5; i++) {
+		tx_address[i] = (address >> (8 * i)) & 0xFF;
+	}
+	tx.set_tx_address(tx_address);
+	tx.send_packet(payload, length);
+	wait_us(Radio::SETTLING_DELAY + 500);
+}
+
+// a pipe 1 packet is read with the pipe 1 width, not the pipe 0 one
+void test_static_widths(void)
+{
+	Air air;
+	SPI tx_spi(NC, NC, NC);
+	SPI rx_spi(NC, NC, NC);
+	Radio tx_chip(air, tx_spi, 1, 2, 3);
+	Radio rx_chip(air, rx_spi, 11, 12, 13);
+	NRF24L01 tx(&tx_spi, 1, 2, 3);
+	NRF24L01 rx(&rx_spi, 11, 12, 13);
+	NRF24L01::Configuration configuration;
+	uint8_t payload[32];
+	uint8_t received[32];
+
+	tx_spi.frequency(SPI_FREQUENCY);
+	rx_spi.frequency(SPI_FREQUENCY);
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	tx.initialize(NRF24L01::register_image(configuration));
+	configuration.mode = NRF24L01::OperationMode::RECEIVER;
+	rx.initialize(NRF24L01::register_image(configuration));
+	rx.set_payload_size(NRF24L01::RxAddressPipe::RX_ADDR_P1, 12);
+	rx.set_payload_size(NRF24L01::RxAddressPipe::RX_ADDR_P0, 32);
+	rx.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+
+	for (uint8_t i = 0; i < 32; i++) {
+		payload[i] = 0x80 + i;
+	}
+	send(tx, PIPE_1_ADDRESS, payload, 12);
+	send(tx, PIPE_0_ADDRESS, payload, 32);
+	CHECK(rx_chip.rx_fifo_level() == 2);
+
+	memset(received, 0, sizeof(received));
+	CHECK(rx.read_packet(received) == 12);
+	CHECK(memcmp(received, payload, 12) == 0);
+	CHECK(rx.read_packet(received) == 32);
+	CHECK(memcmp(received, payload, 32) == 0);
+	CHECK(rx_chip.rx_fifo_level() == 0);
+}
+}
+
+int main(void)
+{
+	test_static_widths();
+
+	return test_result("rx_pipes");
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Driver statistics on the host backend: sent payloads and their latency
+// outside the Tx stream, several payloads completed under a single TX_DS,
+// and Rx counts split between delivered and dropped packets.
+
+#include "host/tests/test_support.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define STATUS_TX_DS		0x20
+
+uint32_t latency_count(const NRF24L01::Statistics &statistics)
+{
+	uint32_t count = 0;
+
+	for (uint8_t i = 0; i < 8; i++) {
+		count += statistics.tx_latency[i];
+	}
+
+	return count;
+}
+
+// send_packet() and a polled TX_DS fill the latency histogram
+void test_send_packet_latency(void)
+{
+	Link link;
+	uint8_t payload[32] = {0};
+
+	link.tx.send_packet(payload, sizeof(payload));
+	wait_us(1000);
+	CHECK(link.tx.status_register() & STATUS_TX_DS);
+	link.tx.clear_interrupt_flags();
+
+	CHECK(link.tx.statistics().tx_packets == 1);
+	CHECK(link.tx.statistics().tx_data_sent == 1);
+	CHECK(latency_count(link.tx.statistics()) == 1);
+}
+
+// 3 payloads sent back to back before TX_DS is cleared count 3 times
+void test_merged_tx_ds(void)
+{
+	Link link;
+	uint8_t payload[32] = {0};
+
+	for (uint8_t i = 0; i < 3; i++) {
+		link.tx.load_packet(payload, sizeof(payload));
+	}
+	link.tx.set_com_ce(1);
+	wait_us(2000);
+	link.tx.set_com_ce(0);
+	link.tx.clear_interrupt_flags();
+
+	CHECK(link.tx.statistics().tx_packets == 3);
+	CHECK(link.tx.statistics().tx_data_sent == 3);
+	CHECK(latency_count(link.tx.statistics()) == 3);
+}
+
+// a full Rx FIFO drained into a single buffer pool: 1 delivered, 2 dropped
+void test_rx_drops(void)
+{
+	Link link;
+	EventQueue queue;
+	PacketPool::Buffer buffers[1];
+	PacketPool pool(buffers, 1);
+	uint8_t payload[32] = {0};
+	NRF24L01::Statistics statistics;
+
+	link.rx.set_packet_pool(&pool);
+	link.rx.start_rx_engine(&queue);
+	for (uint8_t i = 0; i < 3; i++) {
+		link.tx.send_packet(payload, sizeof(payload));
+		wait_us(1000);
+		link.tx.clear_interrupt_flags();
+	}
+	queue.dispatch_once();
+
+	statistics = link.rx.statistics();
+	CHECK(statistics.rx_packets[0] == 1);
+	CHECK(statistics.rx_dropped == 2);
+	CHECK(statistics.rx_corrupt == 0);
+	CHECK(statistics.rx_fifo_full == 1);
+
+	// a single pending packet does not count as a full Rx FIFO
+	link.tx.send_packet(payload, sizeof(payload));
+	wait_us(1000);
+	queue.dispatch_once();
+	statistics = link.rx.statistics();
+	CHECK(statistics.rx_dropped == 3);
+	CHECK(statistics.rx_fifo_full == 1);
+}
+}
+
+int main(void)
+{
+	test_send_packet_latency();
+	test_merged_tx_ds();
+	test_rx_drops();
+
+	return test_result("statistics");
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// TDMA scheduler on the host backend: a slot whose preload is late is
+// skipped without losing the outcome of the slot before it, and the late
+// preload does not put the following slot on air ahead of its boundary.
+
+#include "host/tests/test_support.h"
+#include "nrf24l01/tdma_scheduler.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define ROBOT_ADDRESS		0xA0A0A0A0A0
+#define DISPATCH_PERIOD		10 // in µs
+#define START_DELAY			1000 // in µs, see TdmaScheduler::start()
+#define PRELOAD_TIME		200 // in µs, see TdmaScheduler::build_phases()
+#define GUARD_TIME			50 // in µs
+
+// the event loop of the base station MCU, until the absolute time end
+void run_until(EventQueue &queue, uint32_t end)
+{
+	while (static_cast<int32_t>(end - us_ticker_read()) > 0) {
+		wait_us(DISPATCH_PERIOD);
+		queue.dispatch_once();
+	}
+}
+
+void test_missed_preload(void)
+{
+	Air air;
+	SPI spi(NC, NC, NC);
+	SPI robot_spi(NC, NC, NC);
+	Radio chip(air, spi, 1, 2, 3);
+	Radio robot_chip(air, robot_spi, 11, 12, 13);
+	NRF24L01 radio(&spi, 1, 2, 3);
+	NRF24L01 robot(&robot_spi, 11, 12, 13);
+	EventQueue queue;
+	TdmaScheduler scheduler(&radio, &queue);
+	NRF24L01::Configuration configuration;
+	uint8_t command[32] = {0};
+	uint32_t slot_length = 0;
+	uint32_t boundary = 0;
+
+	spi.frequency(SPI_FREQUENCY);
+	robot_spi.frequency(SPI_FREQUENCY);
+	configuration.auto_acknowledgement = true;
+	configuration.tx_address = ROBOT_ADDRESS;
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	radio.initialize(NRF24L01::register_image(configuration));
+	configuration.mode = NRF24L01::OperationMode::RECEIVER;
+	robot.initialize(NRF24L01::register_image(configuration));
+	robot.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+
+	radio.set_auto_retransmit(1500, 7);
+	for (uint8_t slot = 0; slot < 3; slot++) {
+		CHECK(scheduler.add_slot(ROBOT_ADDRESS) == slot);
+		command[0] = slot;
+		CHECK(scheduler.set_command(slot, command, sizeof(command)));
+	}
+	scheduler.set_guard_time(GUARD_TIME);
+	slot_length = PRELOAD_TIME + scheduler.command_window() + GUARD_TIME;
+
+	CHECK(scheduler.start(10000));
+	boundary = us_ticker_read() + START_DELAY + PRELOAD_TIME;
+
+	// slot 0 is sent, then its preload for slot 1 is late
+	run_until(queue, boundary + slot_length - PRELOAD_TIME - 50);
+	wait_us(PRELOAD_TIME + 100);
+	CHECK(chip.tx_fifo_level() == 0);
+	CHECK(scheduler.statistics().missed == 1);
+
+	// the late preload collects slot 0 and loads slot 2 with CE low
+	queue.dispatch_once();
+	CHECK(scheduler.statistics().delivered == 1);
+	CHECK(chip.tx_fifo_level() == 1);
+	run_until(queue, boundary + 2 * slot_length - 20);
+	CHECK(robot_chip.rx_fifo_level() == 1);
+	CHECK(chip.tx_fifo_level() == 1);
+
+	// slot 2 goes on air at its boundary
+	run_until(queue, boundary + 3 * slot_length - PRELOAD_TIME - 20);
+	CHECK(robot_chip.rx_fifo_level() == 2);
+	CHECK(scheduler.statistics().delivered == 1);
+	// and is collected by the preload of the next superframe
+	run_until(queue, boundary + 10000 - PRELOAD_TIME + 50);
+	CHECK(scheduler.statistics().delivered == 2);
+
+	// the radio retransmit settings are given back
+	scheduler.stop();
+	CHECK(radio.auto_retransmit_delay() == 1500);
+	CHECK(radio.auto_retransmit_count() == 7);
+}
+}
+
+int main(void)
+{
+	test_missed_preload();
+
+	return test_result("tdma_scheduler");
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Shared by the host tests, each built as a single translation unit: the
+// CHECK macro and its failure count, and a transmitter and a receiver
+// powered up on the simulated air.
+
+#ifndef CATIE_NRF24L01_TEST_SUPPORT_H_
+#define CATIE_NRF24L01_TEST_SUPPORT_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "host/nrf24l01_sim.h"
+#include "nrf24l01/nrf24l01.h"
+
+#define SPI_FREQUENCY		8000000
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+namespace {
+int failures = 0;
+
+// exit status of the test, once every check ran
+int test_result(const char *name)
+{
+	if (failures) {
+		printf("%s: %d failures\n", name, failures);
+		return EXIT_FAILURE;
+	}
+	printf("%s: ok\n", name);
+
+	return EXIT_SUCCESS;
+}
+
+NRF24L01::Configuration link_configuration(void)
+{
+	NRF24L01::Configuration configuration;
+
+	configuration.auto_acknowledgement = true;
+
+	return configuration;
+}
+
+// a transmitter on pins 1 to 3 and a listening receiver on pins 11 to 13,
+// each on its own SPI bus and with its own MCU event loop. The transmitter
+// driver may take its IRQ from another pin than the chip one.
+class Link {
+public:
+	Link(const NRF24L01::Configuration &configuration = link_configuration(), PinName tx_irq = 3):
+			_tx_spi(NC, NC, NC), _rx_spi(NC, NC, NC),
+			tx_chip(air, _tx_spi, 1, 2, 3), rx_chip(air, _rx_spi, 11, 12, 13),
+			tx(&_tx_spi, 1, 2, tx_irq), rx(&_rx_spi, 11, 12, 13)
+	{
+		NRF24L01::Configuration image = configuration;
+
+		_tx_spi.frequency(SPI_FREQUENCY);
+		_rx_spi.frequency(SPI_FREQUENCY);
+		image.mode = NRF24L01::OperationMode::RECEIVER;
+		rx.initialize(NRF24L01::register_image(image));
+		rx.set_com_ce(1);
+		image.mode = NRF24L01::OperationMode::TRANSCEIVER;
+		tx.initialize(NRF24L01::register_image(image));
+		wait_us(nrf24l01_host::Radio::POWER_UP_DELAY + nrf24l01_host::Radio::SETTLING_DELAY);
+	}
+
+	// both event loops, every period µs
+	void run(uint32_t duration, uint32_t period)
+	{
+		for (uint32_t elapsed = 0; elapsed < duration; elapsed += period) {
+			wait_us(period);
+			tx_queue.dispatch_once();
+			rx_queue.dispatch_once();
+		}
+	}
+
+	nrf24l01_host::Air air;
+
+private:
+	SPI _tx_spi;
+	SPI _rx_spi;
+
+public:
+	nrf24l01_host::Radio tx_chip;
+	nrf24l01_host::Radio rx_chip;
+	NRF24L01 tx;
+	NRF24L01 rx;
+	EventQueue tx_queue;
+	EventQueue rx_queue;
+};
+}
+
+#endif // CATIE_NRF24L01_TEST_SUPPORT_H_
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tx stream on the host backend: a payload reaching MAX_RT is dropped
+// alone, the ones loaded behind it in the Tx FIFO are still sent in order,
+// from their Tx ring slot or pool buffer kept until then. The adaptive
+// retransmit starts from the settings of the register image, stopping
+// the stream drops what is left, and a flag raised while the engine runs
+// is serviced without another IRQ edge.
+
+#include "host/tests/test_support.h"
+
+using namespace nrf24l01_host;
+
+namespace {
+#define DISPATCH_PERIOD		10 // in µs
+#define MAX_RT_TIMEOUT		20000 // in µs
+#define POOL_SIZE			4
+#define SLOW_SPI_FREQUENCY	100000
+
+// the event loop of the transmitter MCU, for duration µs
+void run(EventQueue &queue, uint32_t duration)
+{
+	for (uint32_t elapsed = 0; elapsed < duration; elapsed += DISPATCH_PERIOD) {
+		wait_us(DISPATCH_PERIOD);
+		queue.dispatch_once();
+	}
+}
+
+// the first payload gets no ACK until MAX_RT, the receiver then listens
+void test_drop_failed_payload(uint8_t count, bool pooled)
+{
+	Air air;
+	SPI tx_spi(NC, NC, NC);
+	SPI rx_spi(NC, NC, NC);
+	Radio tx_chip(air, tx_spi, 1, 2, 3);
+	Radio rx_chip(air, rx_spi, 11, 12, 13);
+	NRF24L01 tx(&tx_spi, 1, 2, 3);
+	NRF24L01 rx(&rx_spi, 11, 12, 13);
+	EventQueue queue;
+	NRF24L01::Configuration configuration;
+	PacketPool::Buffer buffers[POOL_SIZE];
+	PacketPool pool(buffers, POOL_SIZE);
+	PacketPool::Handle handle = PacketPool::INVALID_HANDLE;
+	uint8_t payload[32] = {0};
+	uint8_t received[32];
+	uint32_t elapsed = 0;
+
+	tx_spi.frequency(SPI_FREQUENCY);
+	rx_spi.frequency(SPI_FREQUENCY);
+	configuration.auto_acknowledgement = true;
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	tx.initialize(NRF24L01::register_image(configuration));
+	configuration.mode = NRF24L01::OperationMode::RECEIVER;
+	rx.initialize(NRF24L01::register_image(configuration));
+	wait_us(Radio::POWER_UP_DELAY);
+
+	tx.set_packet_pool(&pool);
+	tx.start_tx_stream(&queue);
+	for (uint8_t i = 0; i < count; i++) {
+		payload[0] = i;
+		if (pooled) {
+			handle = pool.allocate();
+			memcpy(pool.payload(handle), payload, sizeof(payload));
+			pool.set_length(handle, sizeof(payload));
+			CHECK(tx.queue_packet(handle));
+		} else {
+			CHECK(tx.queue_packet(payload, sizeof(payload)));
+		}
+	}
+	while (!tx.statistics().tx_max_retransmit && (elapsed < MAX_RT_TIMEOUT)) {
+		run(queue, DISPATCH_PERIOD);
+		elapsed += DISPATCH_PERIOD;
+	}
+	CHECK(tx.statistics().tx_max_retransmit == 1);
+	// the failed payload is given back, the reloaded ones are still owned
+	CHECK(pool.available() == (pooled ? POOL_SIZE + 1 - count : POOL_SIZE));
+
+	rx.set_com_ce(1);
+	run(queue, 5000);
+	tx.stop_tx_stream();
+
+	CHECK(tx.statistics().tx_dropped == 1);
+	CHECK(tx_chip.tx_fifo_level() == 0);
+	CHECK(rx_chip.rx_fifo_level() == count - 1u);
+	for (uint8_t i = 1; i < count; i++) {
+		CHECK(rx.read_packet(received) == sizeof(payload));
+		CHECK(received[0] == i);
+	}
+	CHECK(pool.available() == POOL_SIZE);
+}
+
+// the adaptive retransmit count goes back to the one of the register image
+// after a lost payload, and the ACK payload length is the longest
+void test_register_image_retransmit(void)
+{
+	Air air;
+	SPI tx_spi(NC, NC, NC);
+	Radio tx_chip(air, tx_spi, 1, 2, 3);
+	NRF24L01 tx(&tx_spi, 1, 2, 3);
+	EventQueue queue;
+	NRF24L01::Configuration configuration;
+	NRF24L01::RegisterImage image;
+	uint8_t payload[32] = {0};
+	uint32_t elapsed = 0;
+
+	tx_spi.frequency(SPI_FREQUENCY);
+	configuration.auto_acknowledgement = true;
+	configuration.dynamic_payload = true;
+	configuration.retransmit_count = 5;
+	configuration.data_rate = NRF24L01::DataRate::_250KBPS;
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	image = NRF24L01::register_image(configuration);
+	// EN_ACK_PAY
+	image.registers[0x1D] |= (1 << 1);
+	tx.initialize(image);
+	wait_us(Radio::POWER_UP_DELAY);
+
+	// 750 µs and 8 bytes more per 250 µs step
+	CHECK(tx.minimum_retransmit_delay() == 1500);
+
+	tx.set_adaptive_retransmit(true);
+	tx.start_tx_stream(&queue);
+	CHECK(tx.queue_packet(payload, sizeof(payload)));
+	while (!tx.statistics().tx_max_retransmit && (elapsed < MAX_RT_TIMEOUT)) {
+		run(queue, DISPATCH_PERIOD);
+		elapsed += DISPATCH_PERIOD;
+	}
+	tx.stop_tx_stream();
+	CHECK(tx.statistics().tx_max_retransmit == 1);
+	CHECK(tx.auto_retransmit_count() == 5);
+}
+
+// stop_tx_stream() drops the payloads loaded in the Tx FIFO and the ones
+// still queued, pool buffers included
+void test_stop_drops_queued(void)
+{
+	Air air;
+	SPI tx_spi(NC, NC, NC);
+	Radio tx_chip(air, tx_spi, 1, 2, 3);
+	NRF24L01 tx(&tx_spi, 1, 2, 3);
+	EventQueue queue;
+	NRF24L01::Configuration configuration;
+	PacketPool::Buffer buffers[POOL_SIZE];
+	PacketPool pool(buffers, POOL_SIZE);
+	PacketPool::Handle handle = PacketPool::INVALID_HANDLE;
+	uint8_t payload[32] = {0};
+
+	tx_spi.frequency(SPI_FREQUENCY);
+	configuration.auto_acknowledgement = true;
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	tx.initialize(NRF24L01::register_image(configuration));
+	tx.set_packet_pool(&pool);
+	wait_us(Radio::POWER_UP_DELAY);
+
+	tx.start_tx_stream(&queue);
+	for (uint8_t i = 0; i < 4; i++) {
+		CHECK(tx.queue_packet(payload, sizeof(payload)));
+	}
+	handle = pool.allocate();
+	pool.set_length(handle, sizeof(payload));
+	CHECK(tx.queue_packet(handle));
+	// the Tx FIFO is filled, nobody acknowledges
+	run(queue, DISPATCH_PERIOD);
+	CHECK(tx_chip.tx_fifo_level() == 3);
+	CHECK(tx.tx_pending() == 2);
+
+	tx.stop_tx_stream();
+	CHECK(tx.statistics().tx_dropped == 5);
+	CHECK(tx.statistics().tx_data_sent == 0);
+	CHECK(tx.tx_pending() == 0);
+	CHECK(tx_chip.tx_fifo_level() == 0);
+	CHECK(pool.available() == POOL_SIZE);
+
+	// the whole Tx ring is available again
+	for (uint8_t i = 0; i < 7; i++) {
+		CHECK(tx.queue_packet(payload, sizeof(payload)));
+	}
+}
+
+// the MAX_RT of the second payload is raised while the transmitter services
+// the TX_DS of the first one over a slow SPI bus: IRQ stays low, no falling
+// edge follows, the engine services it from the STATUS of its last write
+bool drop_second(const Frame &frame)
+{
+	return !frame.ack && (frame.payload[0] == 1);
+}
+
+void test_flag_raised_while_servicing(void)
+{
+	Air air;
+	SPI tx_spi(NC, NC, NC);
+	SPI rx_spi(NC, NC, NC);
+	Radio tx_chip(air, tx_spi, 1, 2, 3);
+	Radio rx_chip(air, rx_spi, 11, 12, 13);
+	NRF24L01 tx(&tx_spi, 1, 2, 3);
+	NRF24L01 rx(&rx_spi, 11, 12, 13);
+	EventQueue queue;
+	NRF24L01::Configuration configuration;
+	uint8_t payload[32] = {0};
+
+	tx_spi.frequency(SLOW_SPI_FREQUENCY);
+	rx_spi.frequency(SPI_FREQUENCY);
+	configuration.auto_acknowledgement = true;
+	configuration.retransmit_count = 0;
+	configuration.mode = NRF24L01::OperationMode::TRANSCEIVER;
+	tx.initialize(NRF24L01::register_image(configuration));
+	configuration.mode = NRF24L01::OperationMode::RECEIVER;
+	rx.initialize(NRF24L01::register_image(configuration));
+	rx.set_com_ce(1);
+	wait_us(Radio::POWER_UP_DELAY + Radio::SETTLING_DELAY);
+	air.set_filter(drop_second);
+
+	tx.start_tx_stream(&queue);
+	for (uint8_t i = 0; i < 3; i++) {
+		payload[0] = i;
+		CHECK(tx.queue_packet(payload, sizeof(payload)));
+	}
+	run(queue, 200000);
+
+	CHECK(tx.statistics().tx_max_retransmit == 1);
+	CHECK(tx.statistics().tx_dropped == 1);
+	CHECK(tx.statistics().tx_data_sent == 2);
+	CHECK(tx_chip.tx_fifo_level() == 0);
+	CHECK(rx_chip.rx_fifo_level() == 2);
+	tx.stop_tx_stream();
+}
+}
+
+int main(void)
+{
+	// failed payload followed by none, one or two others in the Tx FIFO
+	test_drop_failed_payload(1, false);
+	test_drop_failed_payload(2, false);
+	test_drop_failed_payload(3, false);
+	test_drop_failed_payload(1, true);
+	test_drop_failed_payload(2, true);
+	test_drop_failed_payload(3, true);
+	test_register_image_retransmit();
+	test_stop_drops_queued();
+	test_flag_raised_while_servicing();
+
+	return test_result("tx_stream");
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_CHANNEL_HOPPER_H_
+#define CATIE_NRF24L01_CHANNEL_HOPPER_H_
+
+#include "nrf24l01/deferred_timeout.h"
+#include "nrf24l01/nrf24l01.h"
+
+// Frequency hopping over a pseudo random permutation of a channel set:
+// peers configured with the same channels and seed share the sequence.
+// Hops are either synchronised to packet boundaries, hop() being called by
+// the application once per packet, or to a timer with a fixed dwell time.
+// A timed receiver out of sync parks on its current channel until a packet
+// of its peer comes by, then synchronize() realigns its hops on that packet.
+class ChannelHopper
+{
+public:
+	static constexpr uint8_t MAX_CHANNELS = 126;
+
+	ChannelHopper(NRF24L01 *radio, EventQueue *queue);
+
+	uint8_t set_sequence(const uint8_t *channels, uint8_t count, uint32_t seed);
+
+	uint8_t set_sequence(uint8_t first_channel, uint8_t last_channel, uint32_t seed);
+
+	uint8_t length(void);
+
+	uint8_t channel(uint8_t index);
+
+	uint8_t index(void);
+
+	void attach(Callback<void(uint8_t)> func);
+
+	void hop(void);
+
+	void hop_to(uint8_t index);
+
+	void start(uint32_t dwell_time);
+
+	void stop(void);
+
+	void park(uint32_t dwell_time);
+
+	bool synchronize(uint32_t timestamp);
+
+	void set_sync_offset(uint32_t offset);
+
+	uint32_t hops(void);
+
+private:
+	NRF24L01 *_radio;
+	EventQueue *_event_queue;
+	DeferredTimeout _hop_timeout;
+	Callback<void(uint8_t)> _hop_callback;
+
+	uint8_t _sequence[MAX_CHANNELS];
+	uint8_t _length;
+	uint8_t _index;
+	uint32_t _dwell_time;
+	uint32_t _next_hop;
+	uint32_t _sync_offset;
+	bool _sync_offset_set;
+	bool _running;
+	uint32_t _hops;
+
+	void arm(void);
+
+	void timed_hop(void);
+};
+
+#endif // CATIE_NRF24L01_CHANNEL_HOPPER_H_
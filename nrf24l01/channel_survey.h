@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_CHANNEL_SURVEY_H_
+#define CATIE_NRF24L01_CHANNEL_SURVEY_H_
+
+#include "nrf24l01/nrf24l01.h"
+
+// Spectrum survey from the received power detector: each pass sweeps the
+// channels in Rx mode, dwelling the 170 µs RPD needs per channel, and
+// counts the channels where a carrier above -64 dBm was seen. Channels
+// are ranked by their occupancy and the one of their neighbours. The
+// radio is unavailable during scan(), which returns the sweep duration, or
+// 0 while a Tx stream, a timed hopper or a TDMA scheduler drives the radio.
+// The survey hits are not counted in the link statistics.
+class ChannelSurvey
+{
+public:
+	static constexpr uint8_t CHANNEL_COUNT = 126;
+
+	ChannelSurvey(NRF24L01 *radio);
+
+	uint32_t scan(uint8_t passes = 1, uint8_t first_channel = 0, uint8_t last_channel = CHANNEL_COUNT - 1);
+
+	void reset(void);
+
+	void set_auto_select(bool enable);
+
+	uint8_t occupancy(uint8_t channel);
+
+	uint16_t passes(void);
+
+	uint8_t ranked_channels(uint8_t *channels, uint8_t count);
+
+	uint8_t best_channel(void);
+
+	uint32_t sweep_time(void);
+
+private:
+	NRF24L01 *_radio;
+	uint8_t _hits[CHANNEL_COUNT];
+	uint16_t _passes;
+	uint8_t _first_channel;
+	uint8_t _last_channel;
+	bool _auto_select;
+	uint32_t _sweep_time;
+
+	uint16_t score(uint8_t channel);
+};
+
+#endif // CATIE_NRF24L01_CHANNEL_SURVEY_H_
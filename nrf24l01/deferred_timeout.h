@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_DEFERRED_TIMEOUT_H_
+#define CATIE_NRF24L01_DEFERRED_TIMEOUT_H_
+
+#include "nrf24l01/nrf24l01_backend.h"
+
+// Timeout whose function is called from an EventQueue instead of the timer
+// interrupt, so that it may access the SPI bus. attach_at() takes an
+// absolute us_ticker_read() time: a periodic user adds its period to the
+// previous target and the timer and queue latencies do not accumulate. A
+// function already posted to the queue still runs after detach().
+class DeferredTimeout
+{
+public:
+	DeferredTimeout(void);
+
+	void attach_at(EventQueue *queue, Callback<void()> func, uint32_t time);
+
+	void attach_us(EventQueue *queue, Callback<void()> func, uint32_t delay);
+
+	void detach(void);
+
+private:
+	Timeout _timeout;
+	EventQueue *_event_queue;
+	Callback<void()> _func;
+
+	void expired(void);
+};
+
+#endif // CATIE_NRF24L01_DEFERRED_TIMEOUT_H_
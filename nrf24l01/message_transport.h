@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_MESSAGE_TRANSPORT_H_
+#define CATIE_NRF24L01_MESSAGE_TRANSPORT_H_
+
+#include "nrf24l01/deferred_timeout.h"
+#include "nrf24l01/nrf24l01.h"
+
+// Messages larger than a payload over an auto acknowledged link. The sender
+// splits a message into fragments of FRAGMENT_SIZE bytes behind a 3 bytes
+// header, and keeps up to WINDOW_SIZE of them in flight through the Tx
+// stream. The receiver reassembles them in place into the caller buffer,
+// and returns a selective acknowledgement (next expected fragment and a
+// bitmap of the following ones) in the ACK payloads. Only the fragments
+// missing after the retransmit timeout are sent again, a poll frame
+// fetches the acknowledgement when no fragment is left to send.
+// The transport owns the Rx engine and the Tx stream of its radio, which
+// has to be configured with auto acknowledgement and the peer addresses.
+class MessageTransport
+{
+public:
+	static constexpr uint8_t HEADER_SIZE = 3;
+	static constexpr uint8_t FRAGMENT_SIZE = 32 - HEADER_SIZE;
+	static constexpr uint8_t WINDOW_SIZE = 32; // fragments
+	static constexpr uint32_t MAX_MESSAGE_SIZE = 0xFFFFUL * FRAGMENT_SIZE;
+
+	struct Statistics {
+		uint32_t messages_sent;
+		uint32_t messages_failed;
+		uint32_t messages_received;
+		uint32_t fragments_sent;
+		uint32_t fragments_retransmitted;
+		uint32_t fragments_received;
+		uint32_t fragments_duplicated;
+		uint32_t polls;
+		uint32_t transfer_time; // in µs, last message sent
+		uint32_t goodput; // in bit/s, last message sent
+	};
+
+	MessageTransport(NRF24L01 *radio, EventQueue *queue);
+
+	bool send(const void *message, uint32_t length, Callback<void(bool)> func = nullptr);
+
+	void listen(void *buffer, uint32_t capacity, Callback<void(uint32_t)> func);
+
+	void stop(void);
+
+	bool busy(void);
+
+	void set_retransmit_timeout(uint32_t timeout);
+
+	Statistics statistics(void);
+
+	void reset_statistics(void);
+
+private:
+	enum class Role : uint8_t {
+		IDLE,
+		SENDER,
+		RECEIVER
+	};
+
+	NRF24L01 *_radio;
+	EventQueue *_event_queue;
+	DeferredTimeout _service_timeout;
+	Role _role;
+	uint8_t _message_id;
+	uint32_t _fragment_time; // in µs, on air with its acknowledgement
+	uint32_t _retransmit_timeout;
+	bool _retransmit_timeout_set;
+	Statistics _statistics;
+
+	// sender
+	const uint8_t *_tx_message;
+	uint32_t _tx_length;
+	uint16_t _tx_fragments;
+	uint16_t _tx_base; // first unacknowledged fragment
+	uint16_t _tx_next; // first fragment never sent
+	uint32_t _tx_acked; // fragments _tx_base + i acknowledged
+	uint32_t _tx_sent_time[WINDOW_SIZE]; // last transmission, by fragment % WINDOW_SIZE
+	uint32_t _tx_start;
+	uint32_t _tx_progress; // last acknowledgement progress
+	uint32_t _tx_poll;
+	Callback<void(bool)> _tx_callback;
+
+	// receiver
+	uint8_t *_rx_buffer;
+	uint32_t _rx_capacity;
+	uint8_t _rx_message_id;
+	bool _rx_started;
+	bool _rx_complete;
+	uint16_t _rx_base; // next expected fragment
+	uint32_t _rx_received; // fragments _rx_base + 1 + i received
+	int32_t _rx_last; // last fragment index, -1 until known
+	uint32_t _rx_length;
+	uint8_t _rx_pipe;
+	Callback<void(uint32_t)> _rx_callback;
+
+	void arm(uint32_t delay);
+
+	void service(void);
+
+	void pump(void);
+
+	void finish(bool delivered);
+
+	void rx_process(void);
+
+	void acknowledge(const NRF24L01::RxPacket &packet);
+
+	void receive_fragment(const NRF24L01::RxPacket &packet);
+
+	void update_ack_payload(void);
+};
+
+#endif // CATIE_NRF24L01_MESSAGE_TRANSPORT_H_
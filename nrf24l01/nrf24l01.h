@@ -17,6 +17,11 @@
 #ifndef CATIE_NRF24L01_H_
 #define CATIE_NRF24L01_H_
 
+#include "nrf24l01/nrf24l01_backend.h"
+#include "nrf24l01/packet_pool.h"
+
+class RadioGroup;
+
 class NRF24L01
 {
 public:
@@ -26,7 +31,10 @@ public:
 		OP_READ             = 0x00,
 		OP_WRITE            = 0x20,
 		OP_RX               = 0x61,
+		OP_RX_PL_WID        = 0x60,
 		OP_TX               = 0xa0,
+		OP_ACK_PAYLOAD      = 0xa8, // + pipe number
+		OP_TX_NOACK         = 0xb0,
 		OP_NOP              = 0xff,
 		OP_FLUSH_TX			= 0xE1,
 		OP_FLUSH_RX			= 0xE2
@@ -45,6 +53,7 @@ public:
 		REG_STATUS_ZERO     = 0x80,
 		REG_STATUS_RX_DR    = 0x40,
 		REG_STATUS_TX_DS    = 0x20,
+		REG_STATUS_MAX_RT   = 0x10,
 		REG_OBSERVE_TX      = 0x08,
 		REG_RPD             = 0x09,
 		REG_RX_ADDR_P0      = 0x0a,  // 5 bytes
@@ -108,16 +117,210 @@ public:
 		TX_RETRANSMIT		= 5
 	};
 
+	enum class RadioState : uint8_t {
+		POWER_DOWN			= 0,
+		STANDBY_I			= 1,
+		STANDBY_II			= 2,
+		RX					= 3,
+		TX					= 4
+	};
+
+	struct RxPacket {
+		uint32_t timestamp; // in µs
+		uint8_t pipe;
+		uint8_t length;
+		uint8_t payload[32];
+	};
+
+	struct Statistics {
+		uint32_t tx_packets; // loaded in the Tx FIFO
+		uint32_t tx_data_sent; // payloads sent, several per TX_DS event at times
+		uint32_t tx_max_retransmit; // MAX_RT events
+		uint32_t tx_dropped; // Tx stream payloads dropped on MAX_RT
+		uint32_t tx_retransmits; // from OBSERVE_TX ARC_CNT
+		uint32_t tx_lost; // from OBSERVE_TX PLOS_CNT
+		uint32_t tx_latency[8]; // load to TX_DS: < 250 µs, < 500 µs, ... >= 16 ms
+		uint32_t rx_packets[6]; // delivered, per pipe
+		uint32_t rx_dropped; // receive ring or packet pool full
+		uint32_t rx_corrupt; // payload width above 32 bytes, flushed
+		uint32_t rx_fifo_full; // FIFO_STATUS RX_FULL seen by the Rx engine
+		uint32_t rpd_hits; // link RPD reads only, see received_power_detector()
+		uint32_t spi_transactions;
+		uint32_t spi_bytes;
+	};
+
+	// check_health() fault bitmap
+	static constexpr uint8_t FAULT_CONFIG = 0x01; // CONFIG differs from the register cache
+	static constexpr uint8_t FAULT_MAX_RT = 0x02; // MAX_RT never cleared, the Tx FIFO is blocked
+	static constexpr uint8_t FAULT_TX_FULL = 0x04; // Tx FIFO full without progress, CE low
+	static constexpr uint8_t FAULT_TX_STALL = 0x08; // Tx FIFO not emptied with CE high
+	static constexpr uint8_t FAULT_IRQ = 0x10; // interrupt flag never serviced by the engines
+	static constexpr uint8_t FAULT_COUNT = 5;
+
+	// engines driving the radio from timers or interrupts, see active_engines()
+	static constexpr uint8_t ENGINE_TX_STREAM = 0x01;
+	static constexpr uint8_t ENGINE_HOPPER = 0x02;
+	static constexpr uint8_t ENGINE_TDMA = 0x04;
+
+	static constexpr uint8_t REGISTER_COUNT = 0x1E;
+
+	static constexpr uint16_t MIN_RF_FREQUENCY = 2400; // in MHz, channel 0
+	static constexpr uint16_t MAX_RF_FREQUENCY = 2525; // in MHz
+	static constexpr uint32_t SETTLING_TIME = 130; // in µs, Standby-I to Tx/Rx
+
+	// build time radio configuration, see register_image()
+	struct Configuration {
+		OperationMode mode = OperationMode::RECEIVER;
+		DataRate data_rate = DataRate::_2MBPS;
+		RFoutputPower rf_output_power = RFoutputPower::_0dBm;
+		CRCwidth crc_width = CRCwidth::_8bits;
+		uint16_t rf_frequency = 2402; // in MHz
+		uint8_t payload_size = 32;
+		uint8_t rx_pipes = 0x03; // EN_RXADDR bitmap
+		bool auto_acknowledgement = false;
+		uint8_t retransmit_count = 3;
+		bool dynamic_payload = false;
+		uint64_t tx_address = 0xE7E7E7E7E7; // also Rx pipe 0 address, for ACKs
+		uint64_t rx_address = 0xC2C2C2C2C2; // Rx pipe 1 address
+		uint8_t rx_address_lsb[4] = {0xC3, 0xC4, 0xC5, 0xC6}; // pipes 2 to 5, MSBytes of pipe 1
+	};
+
+	struct RegisterImage {
+		OperationMode mode;
+		DataRate data_rate;
+		RFoutputPower rf_output_power;
+		uint16_t rf_frequency;
+		uint8_t payload_size;
+		uint8_t registers[REGISTER_COUNT];
+		uint8_t tx_address[5];
+		uint8_t rx_address[5];
+	};
+
+	static constexpr RegisterAddress rx_address_register(RxAddressPipe rx_addr_pipe)
+	{
+		return static_cast<RegisterAddress>(static_cast<uint8_t>(RegisterAddress::REG_RX_ADDR_P0)
+				+ static_cast<uint8_t>(rx_addr_pipe));
+	}
+
+	static constexpr RegisterAddress payload_size_register(RxAddressPipe rx_addr_pipe)
+	{
+		return static_cast<RegisterAddress>(static_cast<uint8_t>(RegisterAddress::REG_RX_PW_P0)
+				+ static_cast<uint8_t>(rx_addr_pipe));
+	}
+
+	static constexpr uint8_t data_rate_bits(DataRate data_rate)
+	{
+		// RF_DR_LOW is bit 5, RF_DR_HIGH is bit 3
+		return (data_rate == DataRate::_250KBPS) ? (1 << 5) :
+				(data_rate == DataRate::_2MBPS) ? (1 << 3) : 0;
+	}
+
+	static constexpr uint8_t rf_output_power_bits(RFoutputPower rf_output_power)
+	{
+		// RF_PWR is bits 2:1, from -18 dBm (0b00) to 0 dBm (0b11)
+		return (rf_output_power == RFoutputPower::_18dBm) ? (0 << 1) :
+				(rf_output_power == RFoutputPower::_12dBm) ? (1 << 1) :
+				(rf_output_power == RFoutputPower::_6dBm) ? (2 << 1) : (3 << 1);
+	}
+
+	// on-air time of a packet with 5 bytes addresses, in µs: preamble,
+	// address, 9 bits packet control field, payload and CRC
+	static constexpr uint32_t airtime(DataRate data_rate, uint8_t length, CRCwidth crc_width)
+	{
+		return ((8 * (1 + 5 + length + static_cast<uint8_t>(crc_width) / 8) + 9) * 1000
+				+ static_cast<uint16_t>(data_rate) - 1) / static_cast<uint16_t>(data_rate);
+	}
+
+	static constexpr RegisterImage register_image(const Configuration &config)
+	{
+		RegisterImage image = {};
+		uint8_t channel = 2;
+
+		image.mode = config.mode;
+		image.data_rate = config.data_rate;
+		image.rf_output_power = config.rf_output_power;
+		image.rf_frequency = config.rf_frequency;
+		image.payload_size = (config.payload_size > 32) ? 32 : config.payload_size;
+
+		// frequency = 2400 + RF_CH [MHz], out of range values fall back to 2402 MHz
+		if ((config.rf_frequency >= MIN_RF_FREQUENCY) && (config.rf_frequency <= MAX_RF_FREQUENCY)) {
+			channel = config.rf_frequency - MIN_RF_FREQUENCY;
+		} else {
+			image.rf_frequency = 2402;
+		}
+
+		image.registers[0x00] = ((config.crc_width != CRCwidth::NONE) ? (1 << 3) : 0)
+				| ((config.crc_width == CRCwidth::_16bits) ? (1 << 2) : 0)
+				| ((config.mode != OperationMode::POWER_DOWN) ? (1 << 1) : 0)
+				| ((config.mode == OperationMode::RECEIVER) ? (1 << 0) : 0);
+		image.registers[0x01] = (config.auto_acknowledgement || config.dynamic_payload) ? 0x3F : 0x00;
+		image.registers[0x02] = config.rx_pipes & 0x3F;
+		image.registers[0x03] = 0x03; // 5 bytes addresses
+		image.registers[0x04] = (((config.data_rate == DataRate::_250KBPS) ? 1 : 0) << 4)
+				| ((config.retransmit_count > 15) ? 15 : config.retransmit_count);
+		image.registers[0x05] = channel;
+		image.registers[0x06] = data_rate_bits(config.data_rate) | rf_output_power_bits(config.rf_output_power);
+		for (uint8_t pipe = 2; pipe < 6; pipe++) {
+			// pipes 2 to 5 address LSByte
+			image.registers[0x0A + pipe] = config.rx_address_lsb[pipe - 2];
+		}
+		for (uint8_t pipe = 0; pipe < 6; pipe++) {
+			image.registers[0x11 + pipe] = (config.rx_pipes & (1 << pipe)) ? image.payload_size : 0;
+		}
+		image.registers[0x1C] = config.dynamic_payload ? 0x3F : 0x00;
+		image.registers[0x1D] = config.dynamic_payload ? (1 << 2) : 0x00;
+
+		// addresses are sent LSByte first
+		for (uint8_t i = 0; i < 5; i++) {
+			image.tx_address[i] = (config.tx_address >> (8 * i)) & 0xFF;
+			image.rx_address[i] = (config.rx_address >> (8 * i)) & 0xFF;
+		}
+
+		return image;
+	}
+
 	NRF24L01(SPI *spi, PinName com_ce, PinName irq);
 
 	NRF24L01(SPI *spi, PinName com_cs, PinName com_ce, PinName irq);
 
+	NRF24L01(RadioGroup *group, PinName com_cs, PinName com_ce, PinName irq, uint8_t priority = 0);
+
 	void initialize(OperationMode mode, DataRate data_rate, uint16_t rf_frequency);
 
+	void initialize(const RegisterImage &image);
+
 	void attach(Callback<void()> func);
 
 	void clear_interrupt_flags(void);
 
+	void clear_interrupt_flags(uint8_t flags);
+
+	void start_rx_engine(EventQueue *queue, Callback<void()> func = nullptr);
+
+	void stop_rx_engine(void);
+
+	bool receive(RxPacket *packet);
+
+	bool receive(PacketPool::Handle *handle);
+
+	void set_packet_pool(PacketPool *pool);
+
+	uint8_t rx_available(void);
+
+	void start_tx_stream(EventQueue *queue);
+
+	void stop_tx_stream(void);
+
+	void set_engine_active(uint8_t engine, bool active);
+
+	uint8_t active_engines(void);
+
+	bool queue_packet(const void *buffer, uint8_t length, bool ack = true);
+
+	bool queue_packet(PacketPool::Handle handle, bool ack = true);
+
+	uint8_t tx_pending(void);
+
 	void set_interrupt(InterruptMode interrupt_mode);
 
 	void start_listening(void);
@@ -128,6 +331,8 @@ public:
 
 	void set_crc(CRCwidth crc_width);
 
+	CRCwidth crc_width(void);
+
 	void power_up(void);
 
 	void power_down(void);
@@ -136,23 +341,55 @@ public:
 
 	OperationMode mode(void);
 
+	RadioState radio_state(bool from_hardware = false);
+
+	bool ready(void);
+
+	uint32_t time_to_ready(void);
+
 	void set_power_up_and_mode(OperationMode mode);
 
 	void set_auto_acknowledgement(bool enable);
 
 	void set_auto_acknowledgement(uint8_t pipe, bool enable);
 
+	void set_auto_retransmit(uint16_t delay, uint8_t count);
+
+	uint16_t auto_retransmit_delay(void);
+
+	uint8_t auto_retransmit_count(void);
+
+	void set_auto_retransmit_count(uint8_t count, uint8_t ack_payload_size = 0);
+
+	void set_adaptive_retransmit(bool enable);
+
+	uint16_t minimum_retransmit_delay(void);
+
+	uint8_t observe_tx(void);
+
 	void set_payload_size(RxAddressPipe rx_addr_pipe, uint8_t payload_size);
 
 	uint8_t payload_size(void);
 
+	void set_dynamic_payload(bool enable);
+
+	void set_dynamic_payload(RxAddressPipe rx_addr_pipe, bool enable);
+
+	void set_ack_payload(bool enable);
+
+	bool write_ack_payload(RxAddressPipe rx_addr_pipe, const void *buffer, uint8_t length);
+
 	void set_channel(uint8_t channel);
 
+	void hop(uint8_t channel);
+
 	void set_com_ce(uint8_t level);
 
+	uint8_t com_ce(void);
+
 	void set_data_rate(DataRate data_rate);
 
-	DataRate data_rate(void);
+	DataRate data_rate(bool from_hardware = false);
 
 	void attach_receive_payload(RxAddressPipe rx_address_pipe, uint8_t *hw_addr, uint8_t payload_size);
 
@@ -160,12 +397,36 @@ public:
 
 	void attach_receive_address_to_pipe(RxAddressPipe rx_address_pipe, uint8_t *hw_rx_addr);
 
+	void set_rx_pipes(uint8_t pipes);
+
+	uint8_t rx_pipes(void);
+
+	void enable_rx_pipe(RxAddressPipe rx_address_pipe, bool enable);
+
+	void attach_pipe_handler(RxAddressPipe rx_address_pipe, Callback<void(const RxPacket &)> func);
+
 	void send_packet(const void *buffer, uint8_t length);
 
+	void send_packet(PacketPool::Handle handle);
+
+	void send_packet_noack(const void *buffer, uint8_t length);
+
+	void load_packet(const void *buffer, uint8_t length, bool ack = true);
+
+	void set_dynamic_ack(bool enable);
+
 	void start_transfer(void);
 
 	void read_packet(void* buffer, uint8_t length);
 
+	uint8_t read_packet(void *buffer);
+
+#if DEVICE_SPI_ASYNCH
+	bool send_packet_async(const void *buffer, uint8_t length, Callback<void(int)> func);
+
+	bool read_packet_async(void *buffer, uint8_t length, Callback<void(int)> func);
+#endif
+
 	void set_rf_frequency(uint16_t rf_frequency);
 
 	uint16_t rf_frequency(void);
@@ -184,12 +445,70 @@ public:
 
 	uint8_t status_register(void);
 
+	uint8_t cached_status(uint32_t *timestamp = NULL);
+
 	uint8_t fifo_status_register(void);
 
-	uint8_t config_status_register(void);
+	uint8_t config_status_register(bool from_hardware = false);
+
+	bool received_power_detector(bool count = true);
+
+	Statistics statistics(void);
+
+	void reset_statistics(void);
+
+	void set_deferred_sync(bool enable);
+
+	void sync(void);
+
+	void refresh_registers(void);
+
+	void invalidate_registers(void);
+
+	void restore_registers(bool from_reset = false);
+
+	uint8_t check_health(void);
+
+	void recover(uint8_t faults);
+
+	uint32_t tx_stall_time(void);
 
 private:
+	friend class RadioGroup;
+
+	static constexpr uint8_t SPI_FRAME_SIZE = 33; // command + 32 bytes payload
+	static constexpr uint8_t RX_RING_SIZE = 16; // power of 2
+	static constexpr uint8_t TX_RING_SIZE = 8; // power of 2
+
+	struct TxPacket {
+		bool ack;
+		uint8_t length;
+		PacketPool::Handle handle; // payload held by the packet pool
+		uint8_t payload[32];
+	};
+
+	struct TxLoaded {
+		bool ack;
+		uint8_t length;
+		uint8_t slot; // Tx ring slot kept for a reload, TX_RING_SIZE if none
+		PacketPool::Handle handle; // pool buffer kept likewise
+		uint32_t timestamp; // load time
+	};
+#if DEVICE_SPI_ASYNCH
+	static constexpr uint8_t ASYNC_QUEUE_SIZE = 4;
+
+	struct AsyncTransfer {
+		char tx_frame[SPI_FRAME_SIZE];
+		char *rx_buffer;
+		uint8_t length;
+		Callback<void(int)> callback;
+	};
+#endif
+
+
 	SPI *_spi;
+	RadioGroup *_group;
+	int _group_index;
 	DigitalOut _com_cs;
 	DigitalOut _com_ce;
 	InterruptIn _irq;
@@ -198,12 +517,92 @@ private:
 	OperationMode _mode;
 	DataRate _data_rate;
 	RFoutputPower _rf_output_power;
+	uint8_t _registers[REGISTER_COUNT];
+	uint32_t _dirty_registers;
+	bool _registers_valid;
+	bool _deferred_sync;
+	uint8_t _tx_address[5]; // addresses last written, see restore_registers()
+	uint8_t _rx_address[2][5];
+	uint8_t _rx_address_lsb[4];
+	char _spi_tx_frame[SPI_FRAME_SIZE];
+	char _spi_rx_frame[SPI_FRAME_SIZE];
+	uint8_t _status;
+	volatile uint32_t _status_time; // CS assertion of the transaction
+	bool _status_loaded; // STATUS from a payload write
+	uint8_t _status_cleared; // flags written 1 to clear by that transaction
+	volatile uint32_t _select_time;
+	Statistics _statistics;
+	uint8_t _plos_cnt;
+	TxLoaded _tx_loaded[3]; // payloads in the Tx FIFO, oldest first
+	uint8_t _tx_loaded_head;
+	uint8_t _tx_loaded_count;
+	uint32_t _tx_ds_timestamp; // last TX_DS seen
+	EventQueue *_event_queue;
+	volatile uint32_t _irq_timestamp;
+	bool _rx_engine;
+	Callback<void()> _rx_callback;
+	Callback<void(const RxPacket &)> _pipe_handlers[6];
+	RxPacket _rx_ring[RX_RING_SIZE];
+	PacketPool::Handle _rx_handles[RX_RING_SIZE]; // slots received in the packet pool
+	PacketPool *_packet_pool;
+	volatile uint8_t _rx_head;
+	volatile uint8_t _rx_tail;
+	bool _tx_streaming;
+	TxPacket _tx_ring[TX_RING_SIZE];
+	volatile uint8_t _tx_head;
+	volatile uint8_t _tx_tail;
+	volatile uint8_t _tx_free; // oldest slot kept, loaded before _tx_tail
+	uint8_t _ack_payload_size;
+	uint8_t _retransmit_count;
+	bool _adaptive_retransmit;
+	uint8_t _engines;
+	uint32_t _retransmit_history;
+#if DEVICE_SPI_ASYNCH
+	AsyncTransfer _async_queue[ASYNC_QUEUE_SIZE];
+	char _async_rx_frame[SPI_FRAME_SIZE];
+	volatile uint8_t _async_head;
+	volatile uint8_t _async_count;
+	int _async_event;
+	Timeout _async_ce_timeout; // CE pulse end, or start retry
+#endif
+	Timeout _ce_timeout;
+	volatile bool _ce_pulse;
+	volatile bool _ce_rising;
+	volatile uint32_t _ce_time;
+	volatile int8_t _ce_after_pulse; // CE level set during a pulse, -1 if none
+	volatile bool _config_deferred; // CONFIG write held by a CE pulse
+	uint8_t _config_previous; // CONFIG on the chip while held
+	volatile bool _listen_deferred; // start_listening() held by a payload on air
+	volatile bool _tx_on_air; // send_packet() payload, outcome not seen yet
+	bool _powering_up;
+	uint32_t _power_up_time;
+	uint8_t _health_config; // CONFIG read by the last check_health()
+	uint8_t _health_flags; // STATUS flags seen by the previous check
+	uint32_t _health_irq_timestamp; // last interrupt seen by the previous check
+	uint32_t _health_progress;
+	bool _tx_stalled;
+	uint32_t _tx_stall_time;
+
+	void reset_state(void);
+
+	void write_config(uint8_t reg_config);
+
+	void ce_pulse_start(void);
+
+	void ce_pulse_end(void);
+
+	void abort_ce_pulse(void);
+
+	void write_deferred_config(void);
+
+	void tx_outcome(void);
 
 	void spi_select(void);
 
 	void spi_deselect(void);
 
-	void spi_write_payload(const char *buffer, uint8_t length);
+	void spi_write_payload(const char *buffer, uint8_t length,
+			RegisterOperation operation = RegisterOperation::OP_TX);
 
 	void spi_read_payload(char* buffer, uint8_t length);
 
@@ -217,6 +616,64 @@ private:
 
 	uint8_t spi_single_write(uint8_t value);
 
+	uint8_t spi_transfer(uint8_t command, const char *tx_buffer, char *rx_buffer, uint8_t length);
+
+	uint8_t spi_transfer_frame(char *frame, uint8_t length, bool receive);
+
+	void capture_status(uint8_t command, uint8_t status);
+
+	bool tx_fifo_full(void);
+
+	uint8_t rx_payload_length(uint8_t pipe);
+
+	void write_rx_address(RxAddressPipe rx_address_pipe, const uint8_t *address);
+
+	void attach_engines(EventQueue *queue);
+
+	void detach_engines(void);
+
+	void irq_handler(void);
+
+	void process_interrupts(void);
+
+	void rx_drain(uint8_t status, bool rx_full);
+
+	void tx_refill(void);
+
+	void tx_loaded(bool ack, uint8_t length, uint8_t slot = TX_RING_SIZE,
+			PacketPool::Handle handle = PacketPool::INVALID_HANDLE);
+
+	void tx_unloaded(void);
+
+	void tx_completed(uint8_t count, uint32_t timestamp);
+
+	void tx_data_sent(uint32_t timestamp);
+
+	void tx_check_empty(void);
+
+	void tx_drop_failed(void);
+
+	void adapt_retransmit(uint8_t observe, bool lost);
+
+	void update_tx_statistics(uint8_t observe, bool lost);
+
+#if DEVICE_SPI_ASYNCH
+	bool async_enqueue(uint8_t command, const char *tx_buffer, char *rx_buffer, uint8_t length,
+			Callback<void(int)> func);
+
+	void async_start(void);
+
+	void async_transfer_done(int event);
+
+	void async_complete(void);
+#endif
+
+	uint8_t register_value(RegisterAddress register_address);
+
+	void update_register(RegisterAddress register_address, uint8_t value);
+
+	uint8_t fetch_register(RegisterAddress register_address);
+
 };
 
 
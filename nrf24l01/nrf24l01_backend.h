@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_BACKEND_H_
+#define CATIE_NRF24L01_BACKEND_H_
+
+// The driver is bound at compile time to a bus/GPIO backend providing the
+// Mbed OS names it uses: SPI, DigitalOut, InterruptIn, Timeout, EventQueue,
+// Callback/callback, CriticalSectionLock, wait_us, us_ticker_read and
+// __DMB. Mbed OS is the default; define NRF24L01_BACKEND_HEADER to the
+// header of another backend (ie. "host/nrf24l01_host.h").
+#if defined(NRF24L01_BACKEND_HEADER)
+#include NRF24L01_BACKEND_HEADER
+#else
+#include "mbed.h"
+#endif
+
+#endif // CATIE_NRF24L01_BACKEND_H_
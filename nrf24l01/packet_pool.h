@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_PACKET_POOL_H_
+#define CATIE_NRF24L01_PACKET_POOL_H_
+
+#include "nrf24l01/nrf24l01_backend.h"
+
+// Fixed size slab of packet buffers, owned through handles. A buffer holds
+// the SPI frame of a packet: the command or the STATUS byte clocked with
+// the payload, then the payload, so the driver transfers payloads in place.
+// The storage is given by the application and no heap is used; the high
+// water mark tells how many buffers the application really needs. A handle
+// carries the generation of its buffer, so a handle kept after its release
+// is rejected even once the buffer is allocated again.
+class PacketPool
+{
+public:
+	typedef uint16_t Handle; // generation in the MSByte, buffer index in the LSByte
+
+	static constexpr Handle INVALID_HANDLE = 0xFFFF;
+	static constexpr uint8_t MAX_BUFFERS = 0xFF;
+
+	struct Buffer {
+		uint32_t timestamp; // in µs, reception time
+		uint8_t pipe;
+		uint8_t length;
+		uint8_t next; // free list
+		uint8_t generation; // incremented on release
+		bool allocated;
+		char frame[33]; // command/STATUS byte, then the payload
+	};
+
+	struct Statistics {
+		uint8_t size;
+		uint8_t in_use;
+		uint8_t high_water_mark;
+		uint32_t allocations;
+		uint32_t failures; // pool exhausted
+	};
+
+	PacketPool(Buffer *buffers, uint8_t count);
+
+	Handle allocate(void);
+
+	void release(Handle handle);
+
+	uint8_t available(void);
+
+	uint8_t *payload(Handle handle);
+
+	uint8_t length(Handle handle);
+
+	void set_length(Handle handle, uint8_t length);
+
+	uint8_t pipe(Handle handle);
+
+	uint32_t timestamp(Handle handle);
+
+	Statistics statistics(void);
+
+	void reset_statistics(void);
+
+private:
+	friend class NRF24L01;
+
+	static constexpr uint8_t NO_BUFFER = 0xFF;
+
+	Buffer *_buffers;
+	uint8_t _count;
+	uint8_t _free;
+	Statistics _statistics;
+
+	// NULL unless handle is an allocated buffer
+	Buffer *buffer(Handle handle);
+};
+
+#endif // CATIE_NRF24L01_PACKET_POOL_H_
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_RADIO_GROUP_H_
+#define CATIE_NRF24L01_RADIO_GROUP_H_
+
+#include "nrf24l01/nrf24l01_backend.h"
+
+class NRF24L01;
+
+// Several radios on one SPI bus, with their own CS lines. The group owns
+// the bus: it is configured once, and each transaction holds it from CS
+// assertion to deassertion. The IRQs of the radios are serviced from a
+// single dispatcher on the group EventQueue, highest priority pending radio
+// first. Radios streaming from their Tx engines keep CE high, so the SPI
+// refills of one radio overlap the on-air time of the others. Asynchronous
+// transfers also own the bus until their completion interrupt: a blocking
+// transaction waits for it, and an asynchronous transfer started while the
+// bus is held is deferred until it is released.
+class RadioGroup
+{
+public:
+	static constexpr uint8_t MAX_RADIOS = 8;
+
+	RadioGroup(SPI *spi, EventQueue *queue);
+
+	SPI *spi(void);
+
+	EventQueue *event_queue(void);
+
+	uint8_t radio_count(void);
+
+	void lock(void);
+
+	void unlock(void);
+
+private:
+	friend class NRF24L01;
+
+	SPI *_spi;
+	EventQueue *_event_queue;
+
+	NRF24L01 *_radios[MAX_RADIOS];
+	uint8_t _priorities[MAX_RADIOS];
+	uint8_t _order[MAX_RADIOS]; // radio indexes, by priority
+	uint8_t _count;
+
+	volatile uint8_t _pending; // one bit per radio index
+	volatile bool _dispatch_posted;
+	volatile bool _bus_busy; // blocking transaction or asynchronous transfer
+	volatile uint8_t _async_waiting; // one bit per radio index
+
+	int attach(NRF24L01 *radio, uint8_t priority);
+
+	bool acquire(int index);
+
+	void release(void);
+
+	void notify(uint8_t index);
+
+	void dispatch(void);
+
+	int next_pending(void);
+};
+
+#endif // CATIE_NRF24L01_RADIO_GROUP_H_
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_RADIO_WATCHDOG_H_
+#define CATIE_NRF24L01_RADIO_WATCHDOG_H_
+
+#include "nrf24l01/deferred_timeout.h"
+#include "nrf24l01/nrf24l01.h"
+
+// Health monitor of a radio: NRF24L01::check_health() runs periodically
+// from the EventQueue, two SPI transactions per check. The faults it finds
+// are recovered at once by NRF24L01::recover(), and each recovery is
+// reported with its SPI cost and duration.
+class RadioWatchdog
+{
+public:
+	struct Recovery {
+		uint32_t timestamp; // detection, in µs
+		uint8_t faults;
+		uint8_t spi_transactions; // recovery burst
+		uint32_t duration; // detection to radio ready again, in µs
+	};
+
+	struct Statistics {
+		uint32_t checks;
+		uint32_t recoveries;
+		uint32_t faults[NRF24L01::FAULT_COUNT]; // per fault bit, see NRF24L01::FAULT_CONFIG
+		uint32_t duration_max; // in µs
+		uint32_t duration_sum; // in µs, over recoveries
+	};
+
+	RadioWatchdog(NRF24L01 *radio, EventQueue *queue);
+
+	void attach(Callback<void(const Recovery &)> func);
+
+	void start(uint32_t period);
+
+	void stop(void);
+
+	uint8_t check(void);
+
+	Statistics statistics(void);
+
+	void reset_statistics(void);
+
+private:
+	NRF24L01 *_radio;
+	EventQueue *_event_queue;
+	DeferredTimeout _check_timeout;
+	Callback<void(const Recovery &)> _recovery_callback;
+
+	uint32_t _period;
+	uint32_t _next_check;
+	bool _running;
+	Statistics _statistics;
+
+	void recover(uint8_t faults, uint32_t timestamp);
+
+	void arm(void);
+
+	void timed_check(void);
+};
+
+#endif // CATIE_NRF24L01_RADIO_WATCHDOG_H_
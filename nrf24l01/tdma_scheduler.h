@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CATIE_NRF24L01_TDMA_SCHEDULER_H_
+#define CATIE_NRF24L01_TDMA_SCHEDULER_H_
+
+#include "nrf24l01/deferred_timeout.h"
+#include "nrf24l01/nrf24l01.h"
+
+// Time slots within a periodic superframe, one per robot: the command of a
+// slot is sent to the robot address, optionally followed by a reply window
+// where the radio listens on the same address. Slot lengths are computed
+// from the data rate, payload size, CRC width and retransmits of the radio.
+// Each slot is preloaded from the EventQueue ahead of its boundary, a
+// Timeout then only raises CE at the boundary. Robots are expected to
+// reply at the start of their reply window. start() sets the radio ARD and
+// ARC for the slots, stop() restores the previous ones.
+//
+// A slot whose preload is late is skipped: its boundary ends the phase in
+// progress, whose outcome is collected by the late preload before it
+// prepares the following slot.
+class TdmaScheduler
+{
+public:
+	static constexpr uint8_t MAX_SLOTS = 16;
+
+	struct Statistics {
+		uint32_t superframes;
+		uint32_t slots;
+		uint32_t delivered; // commands acknowledged, or sent without ACK
+		uint32_t failed; // MAX_RT
+		uint32_t overruns; // slot still transmitting at its end
+		uint32_t missed; // slot not preloaded at its boundary
+		uint32_t replies;
+		uint32_t jitter_max; // slot boundary latency, in µs
+		uint32_t jitter_sum; // in µs, over slots
+	};
+
+	TdmaScheduler(NRF24L01 *radio, EventQueue *queue);
+
+	int add_slot(uint64_t address, bool reply = false, bool ack = true);
+
+	bool set_command(uint8_t slot, const void *buffer, uint8_t length);
+
+	void attach_reply(Callback<void(uint8_t, const NRF24L01::RxPacket &)> func);
+
+	void set_guard_time(uint16_t guard_time);
+
+	void set_retransmits(uint8_t count);
+
+	uint32_t command_window(void);
+
+	uint32_t reply_window(void);
+
+	uint32_t superframe_duration(void);
+
+	bool start(uint32_t period);
+
+	void stop(void);
+
+	Statistics statistics(void);
+
+	void reset_statistics(void);
+
+private:
+	static constexpr uint8_t MAX_PHASES = 2 * MAX_SLOTS;
+
+	struct Slot {
+		uint8_t address[5];
+		bool reply;
+		bool ack;
+		uint8_t length;
+		uint8_t command[32];
+	};
+
+	// a command or a reply window, CE raised at start
+	struct Phase {
+		uint8_t slot;
+		bool reply;
+		uint32_t start; // from the superframe start, in µs
+	};
+
+	NRF24L01 *_radio;
+	EventQueue *_event_queue;
+	DeferredTimeout _preload_timeout;
+	Timeout _boundary_timeout;
+	Callback<void(uint8_t, const NRF24L01::RxPacket &)> _reply_callback;
+
+	Slot _slots[MAX_SLOTS];
+	uint8_t _slot_count;
+	Phase _phases[MAX_PHASES];
+	uint8_t _phase_count;
+	uint16_t _guard_time;
+	uint8_t _retransmits;
+	uint32_t _period;
+	uint16_t _retransmit_delay; // radio settings before start()
+	uint8_t _retransmit_count;
+	bool _running;
+	bool _replies;
+
+	uint32_t _superframe_start;
+	uint32_t _boundary;
+	volatile uint8_t _phase; // armed at the next boundary
+	volatile int _active; // phase in progress
+	volatile bool _preloaded;
+	int _address_slot; // slot address loaded in the radio
+	uint8_t _reply_slot;
+	Statistics _statistics;
+
+	void build_phases(void);
+
+	void arm(void);
+
+	void boundary_handler(void);
+
+	void preload(void);
+
+	void finish(int phase);
+
+	void prepare(uint8_t phase);
+
+	void select_address(uint8_t slot);
+
+	void received(void);
+};
+
+#endif // CATIE_NRF24L01_TDMA_SCHEDULER_H_
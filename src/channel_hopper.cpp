@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "nrf24l01/channel_hopper.h"
+
+namespace {
+#define MAX_CHANNEL				(NRF24L01::MAX_RF_FREQUENCY - NRF24L01::MIN_RF_FREQUENCY)
+}
+
+ChannelHopper::ChannelHopper(NRF24L01 *radio, EventQueue *queue)
+{
+	_radio = radio;
+	_event_queue = queue;
+	_length = 0;
+	_index = 0;
+	_dwell_time = 0;
+	_next_hop = 0;
+	_sync_offset = 0;
+	_sync_offset_set = false;
+	_running = false;
+	_hops = 0;
+}
+
+uint8_t ChannelHopper::set_sequence(const uint8_t *channels, uint8_t count, uint32_t seed)
+{
+	uint8_t swap = 0;
+	uint8_t j = 0;
+
+	_length = 0;
+	for (uint8_t i = 0; (i < count) && (_length < MAX_CHANNELS); i++) {
+		if (channels[i] <= MAX_CHANNEL) {
+			_sequence[_length++] = channels[i];
+		}
+	}
+
+	// Fisher-Yates shuffle from a xorshift32 generator: the order only
+	// depends on the channels and the seed
+	seed = seed ? seed : 1;
+	for (uint8_t i = _length; i > 1; i--) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		j = seed % i;
+		swap = _sequence[i - 1];
+		_sequence[i - 1] = _sequence[j];
+		_sequence[j] = swap;
+	}
+	_index = 0;
+
+	return _length;
+}
+
+uint8_t ChannelHopper::set_sequence(uint8_t first_channel, uint8_t last_channel, uint32_t seed)
+{
+	uint8_t channels[MAX_CHANNELS];
+	uint8_t count = 0;
+
+	for (uint16_t channel = first_channel; (channel <= last_channel) && (channel <= MAX_CHANNEL); channel++) {
+		channels[count++] = channel;
+	}
+
+	return set_sequence(channels, count, seed);
+}
+
+uint8_t ChannelHopper::length(void)
+{
+	return _length;
+}
+
+uint8_t ChannelHopper::channel(uint8_t index)
+{
+	return _length ? _sequence[index % _length] : 0;
+}
+
+uint8_t ChannelHopper::index(void)
+{
+	return _index;
+}
+
+void ChannelHopper::attach(Callback<void(uint8_t)> func)
+{
+	_hop_callback = func;
+}
+
+void ChannelHopper::hop(void)
+{
+	hop_to(_index + 1);
+}
+
+void ChannelHopper::hop_to(uint8_t index)
+{
+	if (!_length) {
+		return;
+	}
+
+	_index = index % _length;
+	_radio->hop(_sequence[_index]);
+	_hops++;
+
+	if (_hop_callback) {
+		_hop_callback(_sequence[_index]);
+	}
+}
+
+void ChannelHopper::start(uint32_t dwell_time)
+{
+	if (!_length || !dwell_time) {
+		return;
+	}
+	_dwell_time = dwell_time;
+	_running = true;
+	_radio->set_engine_active(NRF24L01::ENGINE_HOPPER, true);
+
+	hop_to(_index);
+	_next_hop = us_ticker_read() + _dwell_time;
+	arm();
+}
+
+void ChannelHopper::stop(void)
+{
+	_running = false;
+	_hop_timeout.detach();
+	_radio->set_engine_active(NRF24L01::ENGINE_HOPPER, false);
+}
+
+void ChannelHopper::park(uint32_t dwell_time)
+{
+	// stay on the current channel until synchronize()
+	stop();
+	_dwell_time = dwell_time;
+}
+
+bool ChannelHopper::synchronize(uint32_t timestamp)
+{
+	uint8_t current = _radio->rf_frequency() - NRF24L01::MIN_RF_FREQUENCY;
+	uint8_t found = 0;
+	uint32_t offset = _sync_offset;
+	uint32_t now = us_ticker_read();
+
+	if (!_dwell_time) {
+		return false;
+	}
+
+	// the current channel gives the position in the sequence
+	for (_index = 0; (_index < _length) && (_sequence[_index] != current); _index++) {
+	}
+	if (_index >= _length) {
+		_index = 0;
+		return false;
+	}
+	found = _index;
+
+	if (!_sync_offset_set) {
+		// peer hop to packet interrupt: settling and packet airtime
+		offset = NRF24L01::SETTLING_TIME + NRF24L01::airtime(_radio->data_rate(), _radio->payload_size(),
+				_radio->crc_width());
+	}
+
+	// realign on the peer hop, skipping the dwell times already elapsed
+	_next_hop = timestamp - offset + _dwell_time;
+	while (static_cast<int32_t>(_next_hop - now) <= 0) {
+		_next_hop += _dwell_time;
+		_index = (_index + 1) % _length;
+	}
+	if (_index != found) {
+		_radio->hop(_sequence[_index]);
+	}
+
+	_running = true;
+	_radio->set_engine_active(NRF24L01::ENGINE_HOPPER, true);
+	arm();
+
+	return true;
+}
+
+void ChannelHopper::set_sync_offset(uint32_t offset)
+{
+	_sync_offset = offset;
+	_sync_offset_set = true;
+}
+
+uint32_t ChannelHopper::hops(void)
+{
+	return _hops;
+}
+
+void ChannelHopper::arm(void)
+{
+	_hop_timeout.attach_at(_event_queue, callback(this, &ChannelHopper::timed_hop), _next_hop);
+}
+
+void ChannelHopper::timed_hop(void)
+{
+	if (!_running) {
+		return;
+	}
+
+	hop();
+	_next_hop += _dwell_time;
+	arm();
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "nrf24l01/channel_survey.h"
+
+namespace {
+#define RPD_DWELL_TIME			170	// in µs, Rx settling and RPD measurement
+}
+
+ChannelSurvey::ChannelSurvey(NRF24L01 *radio)
+{
+	_radio = radio;
+	_auto_select = false;
+	_sweep_time = 0;
+	reset();
+}
+
+uint32_t ChannelSurvey::scan(uint8_t passes, uint8_t first_channel, uint8_t last_channel)
+{
+	NRF24L01::OperationMode mode = _radio->mode();
+	uint8_t channel = _radio->rf_frequency() - NRF24L01::MIN_RF_FREQUENCY;
+	uint8_t enabled = _radio->com_ce();
+	bool powered = (_radio->radio_state() != NRF24L01::RadioState::POWER_DOWN);
+	uint32_t start = us_ticker_read();
+	uint32_t elapsed = 0;
+
+	if (last_channel >= CHANNEL_COUNT) {
+		last_channel = CHANNEL_COUNT - 1;
+	}
+	// the timed engines would retune or key the radio under the sweep
+	if ((first_channel > last_channel) || _radio->active_engines()) {
+		return 0;
+	}
+	_first_channel = first_channel;
+	_last_channel = last_channel;
+
+	_radio->set_com_ce(0);
+	if (!powered) {
+		_radio->power_up();
+	}
+	_radio->set_mode(NRF24L01::OperationMode::RECEIVER);
+	_radio->set_com_ce(1);
+	// no RPD sample before the crystal and the receiver have settled
+	wait_us(_radio->time_to_ready());
+
+	for (uint8_t pass = 0; pass < passes; pass++) {
+		for (uint8_t i = first_channel; i <= last_channel; i++) {
+			// single RF_CH write, CE stays low only for that write
+			elapsed = us_ticker_read();
+			_radio->hop(i);
+			elapsed = us_ticker_read() - elapsed;
+			if (elapsed < RPD_DWELL_TIME) {
+				wait_us(RPD_DWELL_TIME - elapsed);
+			}
+			if (_radio->received_power_detector(false) && (_hits[i] < 0xFF)) {
+				_hits[i]++;
+			}
+		}
+		_passes++;
+	}
+
+	// back to the link, or to the cleanest channel
+	_radio->set_com_ce(0);
+	if (_auto_select) {
+		channel = best_channel();
+	}
+	_radio->hop(channel);
+	_radio->set_mode(mode);
+	if (!powered) {
+		_radio->power_down();
+	}
+	if (enabled) {
+		_radio->set_com_ce(1);
+	}
+
+	_sweep_time = us_ticker_read() - start;
+
+	return _sweep_time;
+}
+
+void ChannelSurvey::reset(void)
+{
+	memset(_hits, 0, sizeof(_hits));
+	_passes = 0;
+	_first_channel = 0;
+	_last_channel = CHANNEL_COUNT - 1;
+}
+
+void ChannelSurvey::set_auto_select(bool enable)
+{
+	_auto_select = enable;
+}
+
+uint8_t ChannelSurvey::occupancy(uint8_t channel)
+{
+	return (channel < CHANNEL_COUNT) ? _hits[channel] : 0;
+}
+
+uint16_t ChannelSurvey::passes(void)
+{
+	return _passes;
+}
+
+uint8_t ChannelSurvey::ranked_channels(uint8_t *channels, uint8_t count)
+{
+	uint8_t ranked = 0;
+	uint8_t j = 0;
+
+	// insertion sort of the scanned channels, cleanest first
+	for (uint8_t i = _first_channel; i <= _last_channel; i++) {
+		for (j = (ranked < count) ? ranked : count; (j > 0) && (score(channels[j - 1]) > score(i)); j--) {
+			if (j < count) {
+				channels[j] = channels[j - 1];
+			}
+		}
+		if (j < count) {
+			channels[j] = i;
+			if (ranked < count) {
+				ranked++;
+			}
+		}
+	}
+
+	return ranked;
+}
+
+uint8_t ChannelSurvey::best_channel(void)
+{
+	uint8_t channel = _first_channel;
+
+	ranked_channels(&channel, 1);
+
+	return channel;
+}
+
+uint32_t ChannelSurvey::sweep_time(void)
+{
+	return _sweep_time;
+}
+
+uint16_t ChannelSurvey::score(uint8_t channel)
+{
+	// a 2 Mbps link spreads over the adjacent channels too
+	uint16_t score = 4 * _hits[channel];
+
+	if (channel > 0) {
+		score += _hits[channel - 1];
+	}
+	if (channel < CHANNEL_COUNT - 1) {
+		score += _hits[channel + 1];
+	}
+
+	return score;
+}
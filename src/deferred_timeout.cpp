@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "nrf24l01/deferred_timeout.h"
+
+DeferredTimeout::DeferredTimeout(void)
+{
+	_event_queue = NULL;
+}
+
+void DeferredTimeout::attach_at(EventQueue *queue, Callback<void()> func, uint32_t time)
+{
+	uint32_t now = us_ticker_read();
+
+	// a time already past fires at once
+	attach_us(queue, func, (static_cast<int32_t>(time - now) > 0) ? (time - now) : 0);
+}
+
+void DeferredTimeout::attach_us(EventQueue *queue, Callback<void()> func, uint32_t delay)
+{
+	_timeout.detach();
+	_event_queue = queue;
+	_func = func;
+	_timeout.attach_us(callback(this, &DeferredTimeout::expired), delay);
+}
+
+void DeferredTimeout::detach(void)
+{
+	_timeout.detach();
+}
+
+void DeferredTimeout::expired(void)
+{
+	// SPI accesses are not allowed in interrupt context
+	_event_queue->call(_func);
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "nrf24l01/message_transport.h"
+
+namespace {
+#define FRAME_DATA				0x00
+#define FRAME_POLL				0x40
+#define FRAME_ACK				0x80
+#define FRAME_TYPE_MASK			0xC0
+#define FRAME_LAST				0x10 // last fragment of the message
+#define MESSAGE_ID_MASK			0x0F
+#define NO_MESSAGE_ID			0xFF
+#define ACK_SIZE				7	// type, next expected fragment, bitmap
+#define SERVICE_FRAGMENTS		4	// fragment times between two services
+#define MAX_STALL_TIMEOUTS		50	// retransmit timeouts without progress
+}
+
+MessageTransport::MessageTransport(NRF24L01 *radio, EventQueue *queue)
+{
+	_radio = radio;
+	_event_queue = queue;
+	_role = Role::IDLE;
+	_message_id = 0;
+	_fragment_time = 0;
+	_retransmit_timeout = 0;
+	_retransmit_timeout_set = false;
+	memset(&_statistics, 0, sizeof(_statistics));
+
+	_tx_message = NULL;
+	_tx_length = 0;
+	_tx_fragments = 0;
+	_tx_base = 0;
+	_tx_next = 0;
+	_tx_acked = 0;
+	_tx_start = 0;
+	_tx_progress = 0;
+	_tx_poll = 0;
+
+	_rx_buffer = NULL;
+	_rx_capacity = 0;
+	_rx_message_id = NO_MESSAGE_ID;
+	_rx_started = false;
+	_rx_complete = false;
+	_rx_base = 0;
+	_rx_received = 0;
+	_rx_last = -1;
+	_rx_length = 0;
+	_rx_pipe = 0;
+}
+
+bool MessageTransport::send(const void *message, uint32_t length, Callback<void(bool)> func)
+{
+	NRF24L01::DataRate data_rate = _radio->data_rate();
+	NRF24L01::CRCwidth crc_width = _radio->crc_width();
+
+	if ((_role == Role::SENDER) || !length || (length > MAX_MESSAGE_SIZE)) {
+		return false;
+	}
+	stop();
+
+	_tx_message = static_cast<const uint8_t *>(message);
+	_tx_length = length;
+	_tx_fragments = (length + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+	_tx_base = 0;
+	_tx_next = 0;
+	_tx_acked = 0;
+	_tx_callback = func;
+	_message_id = (_message_id + 1) & MESSAGE_ID_MASK;
+
+	// back to back fragments: Tx settling, fragment, Rx settling and ACK
+	_fragment_time = 2 * NRF24L01::SETTLING_TIME + NRF24L01::airtime(data_rate, 32, crc_width)
+			+ NRF24L01::airtime(data_rate, ACK_SIZE, crc_width);
+	if (!_retransmit_timeout_set) {
+		// fragments wait in the Tx ring and FIFO before going on air
+		_retransmit_timeout = (WINDOW_SIZE / 2) * _fragment_time;
+	}
+
+	_role = Role::SENDER;
+	_radio->set_ack_payload(true);
+	_radio->set_mode(NRF24L01::OperationMode::TRANSCEIVER);
+	_tx_start = us_ticker_read();
+	_tx_progress = _tx_start;
+	_tx_poll = _tx_start;
+
+	// acknowledgements come back as ACK payloads, through the Rx engine
+	_radio->start_rx_engine(_event_queue, callback(this, &MessageTransport::rx_process));
+	_radio->start_tx_stream(_event_queue);
+	pump();
+	arm(SERVICE_FRAGMENTS * _fragment_time);
+
+	return true;
+}
+
+void MessageTransport::listen(void *buffer, uint32_t capacity, Callback<void(uint32_t)> func)
+{
+	// the buffer is handed back to the transport: the next message starts
+	_rx_buffer = static_cast<uint8_t *>(buffer);
+	_rx_capacity = capacity;
+	_rx_callback = func;
+	_rx_started = false;
+
+	if (_role == Role::RECEIVER) {
+		return;
+	}
+	stop();
+
+	_role = Role::RECEIVER;
+	_radio->set_ack_payload(true);
+	// TX_DS is set on each ACK payload sent: not an interrupt source here
+	_radio->set_interrupt(NRF24L01::InterruptMode::RX_ONLY);
+	_radio->set_mode(NRF24L01::OperationMode::RECEIVER);
+	_radio->start_rx_engine(_event_queue, callback(this, &MessageTransport::rx_process));
+	_radio->set_com_ce(1);
+}
+
+void MessageTransport::stop(void)
+{
+	switch (_role) {
+		case Role::SENDER:
+			finish(false);
+			break;
+		case Role::RECEIVER:
+			_radio->set_com_ce(0);
+			_radio->stop_rx_engine();
+			_role = Role::IDLE;
+			break;
+		case Role::IDLE:
+			break;
+	}
+}
+
+bool MessageTransport::busy(void)
+{
+	return (_role == Role::SENDER);
+}
+
+void MessageTransport::set_retransmit_timeout(uint32_t timeout)
+{
+	_retransmit_timeout = timeout;
+	_retransmit_timeout_set = (timeout != 0);
+}
+
+MessageTransport::Statistics MessageTransport::statistics(void)
+{
+	return _statistics;
+}
+
+void MessageTransport::reset_statistics(void)
+{
+	memset(&_statistics, 0, sizeof(_statistics));
+}
+
+void MessageTransport::arm(uint32_t delay)
+{
+	_service_timeout.attach_us(_event_queue, callback(this, &MessageTransport::service), delay);
+}
+
+void MessageTransport::service(void)
+{
+	uint32_t now = us_ticker_read();
+	uint8_t poll = FRAME_POLL | _message_id;
+
+	if (_role != Role::SENDER) {
+		return;
+	}
+
+	if ((now - _tx_progress) > (MAX_STALL_TIMEOUTS * _retransmit_timeout)) {
+		finish(false);
+		return;
+	}
+
+	pump();
+
+	// nothing left to send: the poll fetches the receiver acknowledgement
+	if (!_radio->tx_pending() && ((now - _tx_poll) >= (SERVICE_FRAGMENTS * _fragment_time))
+			&& _radio->queue_packet(&poll, 1)) {
+		_tx_poll = now;
+		_statistics.polls++;
+	}
+
+	arm(SERVICE_FRAGMENTS * _fragment_time);
+}
+
+void MessageTransport::pump(void)
+{
+	uint8_t frame[32];
+	uint32_t now = us_ticker_read();
+	uint32_t end = _tx_base + WINDOW_SIZE;
+	uint32_t offset = 0;
+	uint8_t length = 0;
+	bool retransmit = false;
+
+	if (end > _tx_fragments) {
+		end = _tx_fragments;
+	}
+
+	// missing fragments first, then the new ones, while the Tx ring has room
+	for (uint32_t fragment = _tx_base; fragment < end; fragment++) {
+		retransmit = (fragment < _tx_next);
+		if (retransmit && ((_tx_acked & (1UL << (fragment - _tx_base)))
+				|| ((now - _tx_sent_time[fragment % WINDOW_SIZE]) < _retransmit_timeout))) {
+			continue;
+		}
+
+		offset = fragment * FRAGMENT_SIZE;
+		length = ((_tx_length - offset) > FRAGMENT_SIZE) ? FRAGMENT_SIZE : (_tx_length - offset);
+		frame[0] = FRAME_DATA | _message_id | ((fragment + 1 == _tx_fragments) ? FRAME_LAST : 0);
+		frame[1] = fragment & 0xFF;
+		frame[2] = fragment >> 8;
+		memcpy(&frame[HEADER_SIZE], &_tx_message[offset], length);
+		if (!_radio->queue_packet(frame, HEADER_SIZE + length)) {
+			break;
+		}
+
+		_tx_sent_time[fragment % WINDOW_SIZE] = now;
+		_statistics.fragments_sent++;
+		if (retransmit) {
+			_statistics.fragments_retransmitted++;
+		} else {
+			_tx_next++;
+		}
+	}
+}
+
+void MessageTransport::finish(bool delivered)
+{
+	Callback<void(bool)> func = _tx_callback;
+
+	_service_timeout.detach();
+	_radio->stop_tx_stream();
+	_radio->stop_rx_engine();
+	_role = Role::IDLE;
+
+	if (delivered) {
+		_statistics.messages_sent++;
+		_statistics.transfer_time = us_ticker_read() - _tx_start;
+		_statistics.goodput = _statistics.transfer_time ?
+				static_cast<uint32_t>((static_cast<uint64_t>(_tx_length) * 8 * 1000000)
+				/ _statistics.transfer_time) : 0;
+	} else {
+		_statistics.messages_failed++;
+	}
+
+	if (func) {
+		func(delivered);
+	}
+}
+
+void MessageTransport::rx_process(void)
+{
+	NRF24L01::RxPacket packet;
+	bool received = false;
+	bool complete = _rx_complete;
+
+	while (_radio->receive(&packet)) {
+		if (_role == Role::SENDER) {
+			acknowledge(packet);
+		} else if (_role == Role::RECEIVER) {
+			receive_fragment(packet);
+			received = true;
+		}
+	}
+
+	if (received) {
+		update_ack_payload();
+		// notified once the final acknowledgement is loaded
+		if (_rx_complete && !complete && _rx_callback) {
+			_rx_callback(_rx_length);
+		}
+	}
+	if (_role == Role::SENDER) {
+		pump();
+	}
+}
+
+void MessageTransport::acknowledge(const NRF24L01::RxPacket &packet)
+{
+	uint32_t base = 0;
+	uint32_t received = 0;
+	int32_t shift = 0;
+
+	if ((_role != Role::SENDER) || (packet.length < ACK_SIZE)
+			|| (packet.payload[0] != (FRAME_ACK | _message_id))) {
+		return;
+	}
+
+	base = packet.payload[1] | (packet.payload[2] << 8);
+	received = packet.payload[3] | (packet.payload[4] << 8) | (packet.payload[5] << 16)
+			| (static_cast<uint32_t>(packet.payload[6]) << 24);
+	if (base > _tx_next) {
+		return;
+	}
+
+	if (base > _tx_base) {
+		shift = base - _tx_base;
+		_tx_acked = (shift < 32) ? (_tx_acked >> shift) : 0;
+		_tx_base = base;
+		_tx_progress = us_ticker_read();
+	}
+
+	// received bit i is fragment base + 1 + i, possibly from an older report
+	shift = static_cast<int32_t>(base + 1) - static_cast<int32_t>(_tx_base);
+	if ((shift >= 0) && (shift < 32)) {
+		_tx_acked |= received << shift;
+	} else if ((shift < 0) && (shift > -32)) {
+		_tx_acked |= received >> -shift;
+	}
+	while ((_tx_acked & 1) && (_tx_base < _tx_next)) {
+		_tx_acked >>= 1;
+		_tx_base++;
+		_tx_progress = us_ticker_read();
+	}
+
+	if (_tx_base >= _tx_fragments) {
+		finish(true);
+	}
+}
+
+void MessageTransport::receive_fragment(const NRF24L01::RxPacket &packet)
+{
+	uint8_t type = packet.payload[0] & FRAME_TYPE_MASK;
+	uint8_t id = packet.payload[0] & MESSAGE_ID_MASK;
+	uint32_t index = 0;
+	uint32_t offset = 0;
+	uint8_t length = 0;
+	bool in_order = false;
+
+	// a poll only asks for the acknowledgement, on the pipe of the sender
+	_rx_pipe = packet.pipe;
+	if ((type != FRAME_DATA) || (packet.length < HEADER_SIZE) || !_rx_buffer) {
+		return;
+	}
+
+	if (_rx_complete && (id == _rx_message_id)) {
+		// late copy of the last message, its acknowledgement is unchanged
+		_statistics.fragments_duplicated++;
+		return;
+	}
+	if (_rx_started && _rx_complete) {
+		// the application owns the buffer until listen()
+		return;
+	}
+	if (!_rx_started || (id != _rx_message_id)) {
+		// a new message, or the sender gave up the previous one
+		_rx_message_id = id;
+		_rx_started = true;
+		_rx_complete = false;
+		_rx_base = 0;
+		_rx_received = 0;
+		_rx_last = -1;
+		_rx_length = 0;
+	}
+
+	index = packet.payload[1] | (packet.payload[2] << 8);
+	in_order = (index == _rx_base);
+	if (index > static_cast<uint32_t>(_rx_base) + WINDOW_SIZE) {
+		// beyond the window, sent again later
+		return;
+	}
+	if ((index < _rx_base) || (!in_order && (_rx_received & (1UL << (index - _rx_base - 1))))) {
+		_statistics.fragments_duplicated++;
+		return;
+	}
+
+	offset = index * FRAGMENT_SIZE;
+	length = packet.length - HEADER_SIZE;
+	if (offset + length > _rx_capacity) {
+		// never acknowledged: the sender gives up
+		return;
+	}
+	memcpy(&_rx_buffer[offset], &packet.payload[HEADER_SIZE], length);
+	_statistics.fragments_received++;
+
+	if (packet.payload[0] & FRAME_LAST) {
+		_rx_last = index;
+		_rx_length = offset + length;
+	}
+
+	if (in_order) {
+		// slide the window over the fragments already received
+		do {
+			in_order = _rx_received & 1;
+			_rx_received >>= 1;
+			_rx_base++;
+		} while (in_order);
+	} else {
+		_rx_received |= 1UL << (index - _rx_base - 1);
+	}
+
+	if ((_rx_last >= 0) && (_rx_base > static_cast<uint32_t>(_rx_last))) {
+		_rx_complete = true;
+		_statistics.messages_received++;
+	}
+}
+
+void MessageTransport::update_ack_payload(void)
+{
+	uint8_t ack[ACK_SIZE];
+
+	if (_rx_message_id == NO_MESSAGE_ID) {
+		return;
+	}
+
+	ack[0] = FRAME_ACK | _rx_message_id;
+	ack[1] = _rx_base & 0xFF;
+	ack[2] = _rx_base >> 8;
+	ack[3] = _rx_received & 0xFF;
+	ack[4] = (_rx_received >> 8) & 0xFF;
+	ack[5] = (_rx_received >> 16) & 0xFF;
+	ack[6] = (_rx_received >> 24) & 0xFF;
+
+	// only the latest acknowledgement is worth sending
+	_radio->flush_tx();
+	_radio->write_ack_payload(static_cast<NRF24L01::RxAddressPipe>(_rx_pipe), ack, ACK_SIZE);
+}
@@ -14,18 +14,46 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include "mbed.h"
-
 #include "nrf24l01/nrf24l01.h"
+#include "nrf24l01/radio_group.h"
 
 namespace {
-#define _SPI_API_WITHOUT_CS_
+// define _SPI_API_WITHOUT_CS_ to clock the frames byte per byte instead of
+// a single SPI block transfer
 #define MAX_PAYLOAD_SIZE		32 // in bytes
 #define MAX_DATA_PIPE			6
-#define MIN_RF_FREQUENCY    	2400 // in Hz
-#define MAX_RF_FREQUENCY		2525 // in Hz
-#define DEFAULT_RF_FREQUENCY	2402 // in Hz
-#define HARDWARE_DELAY			4	 // in µs
+#define DEFAULT_RF_FREQUENCY	2402 // in MHz
+#define HARDWARE_DELAY			4	 // in µs, CE rising edge to CSN low
+#define TX_PULSE_DURATION		20	 // in µs
+#define POWER_UP_TIME			1500 // in µs, power down to Standby-I
+#define RETRANSMIT_DELAY_STEP	250	 // in µs
+#define ASYNC_RETRY_DELAY		10	 // in µs, SPI busy with another transfer
+#define MAX_RETRANSMIT_COUNT	15
+
+// single byte registers mirrored by the shadow register cache: status,
+// observe, RPD and FIFO registers are volatile and always read from the
+// chip, multiple bytes address registers are never cached
+#define CACHED_REGISTERS_MASK	0x307E007F
+
+// power on reset values of the register file, pipes 2 to 5 address LSByte
+// included
+const uint8_t RESET_REGISTERS[NRF24L01::REGISTER_COUNT] = {
+	0x08, 0x3F, 0x03, 0x03, 0x03, 0x02, 0x0E, 0x0E, 0x00, 0x00,
+	0x00, 0x00, 0xC3, 0xC4, 0xC5, 0xC6
+};
+#define RESET_TX_ADDRESS		0xE7 // every byte, also Rx pipe 0
+#define RESET_RX_ADDRESS		0xC2 // every byte, Rx pipe 1
+
+bool reset_address(const uint8_t *address, uint8_t value)
+{
+	for (uint8_t i = 0; i < 5; i++) {
+		if (address[i] != value) {
+			return false;
+		}
+	}
+
+	return true;
+}
 }
 
 NRF24L01::NRF24L01(SPI *spi, PinName com_ce, PinName irq):
@@ -33,12 +61,11 @@ NRF24L01::NRF24L01(SPI *spi, PinName com_ce, PinName irq):
 {
 	_spi = spi;
 	_spi->format(8,0);
+	_group = NULL;
+	_group_index = -1;
 	_com_ce = 0;
-	_rf_frequency = DEFAULT_RF_FREQUENCY;
-	_payload_size = MAX_PAYLOAD_SIZE;
+	reset_state();
 	_mode = OperationMode::POWER_DOWN;
-	_data_rate = DataRate::_2MBPS;
-	_rf_output_power = RFoutputPower::_0dBm;
 }
 
 NRF24L01::NRF24L01(SPI *spi, PinName com_cs, PinName com_ce, PinName irq):
@@ -46,13 +73,90 @@ NRF24L01::NRF24L01(SPI *spi, PinName com_cs, PinName com_ce, PinName irq):
 {
 	_spi = spi;
 	_spi->format(8,0);
+	_group = NULL;
+	_group_index = -1;
+	_com_cs = 1;
+	_com_ce = 0;
+	reset_state();
+}
+
+NRF24L01::NRF24L01(RadioGroup *group, PinName com_cs, PinName com_ce, PinName irq, uint8_t priority):
+		_com_cs(com_cs), _com_ce(com_ce), _irq(irq)
+{
+	// the bus is owned and configured by the group
+	_spi = group->spi();
+	_group = group;
+	_group_index = group->attach(this, priority);
+	if (_group_index < 0) {
+		// group full: the radio runs on its own
+		_group = NULL;
+	}
 	_com_cs = 1;
 	_com_ce = 0;
+	reset_state();
+}
+
+void NRF24L01::reset_state(void)
+{
 	_rf_frequency = DEFAULT_RF_FREQUENCY;
 	_payload_size = MAX_PAYLOAD_SIZE;
 	_mode = OperationMode::TRANSCEIVER;
 	_data_rate = DataRate::_2MBPS;
 	_rf_output_power = RFoutputPower::_0dBm;
+	_dirty_registers = 0;
+	_registers_valid = false;
+	_deferred_sync = false;
+	memset(_tx_address, RESET_TX_ADDRESS, sizeof(_tx_address));
+	memset(_rx_address[0], RESET_TX_ADDRESS, sizeof(_rx_address[0]));
+	memset(_rx_address[1], RESET_RX_ADDRESS, sizeof(_rx_address[1]));
+	memcpy(_rx_address_lsb, &RESET_REGISTERS[static_cast<uint8_t>(RegisterAddress::REG_RX_ADDR_P2)],
+			sizeof(_rx_address_lsb));
+	_status = 0;
+	_status_time = 0;
+	_status_loaded = false;
+	_status_cleared = 0;
+	_select_time = 0;
+	memset(&_statistics, 0, sizeof(_statistics));
+	_plos_cnt = 0;
+	_tx_loaded_head = 0;
+	_tx_loaded_count = 0;
+	_tx_ds_timestamp = 0;
+	_event_queue = NULL;
+	_irq_timestamp = 0;
+	_rx_engine = false;
+	_rx_head = 0;
+	_rx_tail = 0;
+	_packet_pool = NULL;
+	_tx_streaming = false;
+	_tx_head = 0;
+	_tx_tail = 0;
+	_tx_free = 0;
+	_ack_payload_size = 0;
+	_retransmit_count = 3;
+	_adaptive_retransmit = false;
+	_engines = 0;
+	_retransmit_history = 0;
+	_ce_pulse = false;
+	_ce_rising = false;
+	_ce_time = 0;
+	_ce_after_pulse = -1;
+	_config_deferred = false;
+	_config_previous = 0;
+	_listen_deferred = false;
+	_tx_on_air = false;
+	_powering_up = false;
+	_power_up_time = 0;
+	_health_config = 0;
+	_health_flags = 0;
+	_health_irq_timestamp = 0;
+	_health_progress = 0;
+	_tx_stalled = false;
+	_tx_stall_time = 0;
+#if DEVICE_SPI_ASYNCH
+	_async_head = 0;
+	_async_count = 0;
+	_async_event = 0;
+#endif
 }
 
 void NRF24L01::initialize(OperationMode mode, DataRate data_rate, uint16_t rf_frequency)
@@ -77,59 +181,761 @@ void NRF24L01::initialize(OperationMode mode, DataRate data_rate, uint16_t rf_fr
 
 }
 
+void NRF24L01::initialize(const RegisterImage &image)
+{
+	uint8_t address = 0;
+
+	set_com_ce(0);
+
+	// precomputed image: write only, no read-modify-write, CONFIG last
+	for (address = static_cast<uint8_t>(RegisterAddress::REG_EN_AA); address < REGISTER_COUNT; address++) {
+		if (CACHED_REGISTERS_MASK & (1UL << address)) {
+			spi_write_register(static_cast<RegisterAddress>(address), image.registers[address]);
+			_registers[address] = image.registers[address];
+		}
+	}
+	spi_write_register(RegisterAddress::REG_TX_ADDR, (const char *)image.tx_address, 5);
+	spi_write_register(RegisterAddress::REG_RX_ADDR_P0, (const char *)image.tx_address, 5);
+	spi_write_register(RegisterAddress::REG_RX_ADDR_P1, (const char *)image.rx_address, 5);
+	memcpy(_tx_address, image.tx_address, 5);
+	memcpy(_rx_address[0], image.tx_address, 5);
+	memcpy(_rx_address[1], image.rx_address, 5);
+	for (address = static_cast<uint8_t>(RegisterAddress::REG_RX_ADDR_P2);
+			address <= static_cast<uint8_t>(RegisterAddress::REG_RX_ADDR_P5); address++) {
+		// LSByte of the enabled pipes 2 to 5 only
+		if (image.registers[0x02] & (1 << (address - static_cast<uint8_t>(RegisterAddress::REG_RX_ADDR_P0)))) {
+			spi_write_register(static_cast<RegisterAddress>(address), image.registers[address]);
+			_rx_address_lsb[address - static_cast<uint8_t>(RegisterAddress::REG_RX_ADDR_P2)] = image.registers[address];
+		}
+	}
+	spi_write_register(RegisterAddress::REG_CONFIG, image.registers[0]);
+	_registers[0] = image.registers[0];
+	// the previous power state is unknown, assume a full power up
+	_powering_up = image.registers[0] & (1 << 1);
+	_power_up_time = us_ticker_read();
+
+	_dirty_registers = 0;
+	_registers_valid = true;
+
+	_mode = image.mode;
+	_data_rate = image.data_rate;
+	_rf_output_power = image.rf_output_power;
+	_rf_frequency = image.rf_frequency;
+	_payload_size = image.payload_size;
+
+	// as set by set_auto_retransmit() and set_auto_retransmit_count(): ACK
+	// payloads of any length may be enabled, the longest is assumed
+	_retransmit_count = image.registers[static_cast<uint8_t>(RegisterAddress::REG_SETUP_RETR)] & 0x0F;
+	_ack_payload_size = (image.registers[static_cast<uint8_t>(RegisterAddress::REG_FEATURE)] & (1 << 1)) ?
+			MAX_PAYLOAD_SIZE : 0;
+	_retransmit_history = 0;
+}
+
 void NRF24L01::attach(Callback<void()> func)
 {
 	 if (func) {
 		 _irq.fall(func);
 		 _irq.enable_irq();
 	} else {
-		_irq.fall(NULL);
+		_irq.fall(nullptr);
 		_irq.disable_irq();
 	}
 }
 
 void NRF24L01::clear_interrupt_flags(void)
 {
-	spi_write_register(RegisterAddress::REG_STATUS, 0x7E);
+	clear_interrupt_flags(0x70);
+}
+
+void NRF24L01::clear_interrupt_flags(uint8_t flags)
+{
+	// RX_DR, TX_DS and MAX_RT only, written 1 to clear
+	spi_write_register(RegisterAddress::REG_STATUS, flags & 0x70);
+
+	// the STATUS clocked out tells the flags actually cleared
+	flags &= _status;
+	if (flags & static_cast<uint8_t>(RegisterAddress::REG_STATUS_TX_DS)) {
+		tx_data_sent(us_ticker_read());
+		tx_check_empty();
+	}
+	if (flags & static_cast<uint8_t>(RegisterAddress::REG_STATUS_MAX_RT)) {
+		_statistics.tx_max_retransmit++;
+	}
+	if ((flags & 0x30) && _tx_on_air) {
+		tx_outcome();
+	}
+}
+
+/***************************************************************************
+ * interrupt driven engines
+ *
+ * The IRQ handler only timestamps the event, SPI accesses are deferred to
+ * the EventQueue. The receive ring and the transmit queue are single
+ * producer/single consumer, the EventQueue thread being on the driver side.
+ ***************************************************************************/
+void NRF24L01::start_rx_engine(EventQueue *queue, Callback<void()> func)
+{
+	_rx_callback = func;
+	_rx_engine = true;
+
+	// enable RX_DR interrupt
+	update_register(RegisterAddress::REG_CONFIG, register_value(RegisterAddress::REG_CONFIG) & 0xBF);
+	attach_engines(queue);
+}
+
+void NRF24L01::stop_rx_engine(void)
+{
+	_rx_engine = false;
+	detach_engines();
+}
+
+bool NRF24L01::receive(RxPacket *packet)
+{
+	uint8_t tail = _rx_tail;
+	PacketPool::Buffer *buffer = NULL;
+
+	if (tail == _rx_head) {
+		return false;
+	}
+
+	if (_rx_handles[tail] != PacketPool::INVALID_HANDLE) {
+		// received in the packet pool, copied for this API only
+		buffer = _packet_pool->buffer(_rx_handles[tail]);
+		packet->timestamp = buffer->timestamp;
+		packet->pipe = buffer->pipe;
+		packet->length = buffer->length;
+		memcpy(packet->payload, &buffer->frame[1], buffer->length);
+		_packet_pool->release(_rx_handles[tail]);
+	} else {
+		memcpy(packet, &_rx_ring[tail], sizeof(RxPacket));
+	}
+	// release the slot only once the packet has been copied
+	__DMB();
+	_rx_tail = (tail + 1) & (RX_RING_SIZE - 1);
+
+	return true;
+}
+
+bool NRF24L01::receive(PacketPool::Handle *handle)
+{
+	uint8_t tail = _rx_tail;
+	PacketPool::Buffer *buffer = NULL;
+
+	if ((tail == _rx_head) || !_packet_pool) {
+		return false;
+	}
+
+	// the application owns the handle until it releases it to the pool
+	*handle = _rx_handles[tail];
+	if (*handle == PacketPool::INVALID_HANDLE) {
+		// received before the pool was set
+		*handle = _packet_pool->allocate();
+		if (*handle == PacketPool::INVALID_HANDLE) {
+			return false;
+		}
+		buffer = _packet_pool->buffer(*handle);
+		buffer->timestamp = _rx_ring[tail].timestamp;
+		buffer->pipe = _rx_ring[tail].pipe;
+		buffer->length = _rx_ring[tail].length;
+		memcpy(&buffer->frame[1], _rx_ring[tail].payload, _rx_ring[tail].length);
+	}
+	__DMB();
+	_rx_tail = (tail + 1) & (RX_RING_SIZE - 1);
+
+	return true;
+}
+
+void NRF24L01::set_packet_pool(PacketPool *pool)
+{
+	// Rx engine payloads are received in the pool buffers from now on
+	_packet_pool = pool;
+}
+
+uint8_t NRF24L01::rx_available(void)
+{
+	return (_rx_head - _rx_tail) & (RX_RING_SIZE - 1);
+}
+
+void NRF24L01::start_tx_stream(EventQueue *queue)
+{
+	_tx_streaming = true;
+	while (_tx_loaded_count) {
+		tx_unloaded();
+	}
+
+	// enable TX_DS and MAX_RT interrupts
+	update_register(RegisterAddress::REG_CONFIG, register_value(RegisterAddress::REG_CONFIG) & 0xCF);
+	attach_engines(queue);
+
+	// hold CE high: the chip sends every loaded payload back to back and
+	// waits in Standby-II when its Tx FIFO is empty
+	set_com_ce(1);
+}
+
+void NRF24L01::stop_tx_stream(void)
+{
+	uint8_t tail = _tx_tail;
+
+	_tx_streaming = false;
+	set_com_ce(0);
+
+	// the payloads loaded or still queued are dropped, the next stream
+	// starts empty
+	flush_tx();
+	while (tail != _tx_head) {
+		if ((_tx_ring[tail].handle != PacketPool::INVALID_HANDLE) && _packet_pool) {
+			_packet_pool->release(_tx_ring[tail].handle);
+		}
+		_statistics.tx_dropped++;
+		tail = (tail + 1) & (TX_RING_SIZE - 1);
+	}
+	_tx_tail = tail;
+	_tx_free = tail;
+
+	detach_engines();
+}
+
+void NRF24L01::set_engine_active(uint8_t engine, bool active)
+{
+	CriticalSectionLock lock;
+
+	_engines = active ? (_engines | engine) : (_engines & ~engine);
+}
+
+uint8_t NRF24L01::active_engines(void)
+{
+	return _engines | (_tx_streaming ? ENGINE_TX_STREAM : 0);
+}
+
+bool NRF24L01::queue_packet(const void *tx_packet, uint8_t length, bool ack)
+{
+	uint8_t head = _tx_head;
+	uint8_t next = (head + 1) & (TX_RING_SIZE - 1);
+
+	// the chip sends no empty payload
+	if ((next == _tx_free) || !length) {
+		return false;
+	}
+
+	// manage payload length limit
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+	memcpy(_tx_ring[head].payload, tx_packet, length);
+	_tx_ring[head].length = length;
+	_tx_ring[head].ack = ack;
+	_tx_ring[head].handle = PacketPool::INVALID_HANDLE;
+	// publish the slot only once the packet has been written
+	__DMB();
+	_tx_head = next;
+
+	if (_tx_streaming && _event_queue) {
+		_event_queue->call(callback(this, &NRF24L01::tx_refill));
+	}
+
+	return true;
+}
+
+bool NRF24L01::queue_packet(PacketPool::Handle handle, bool ack)
+{
+	uint8_t head = _tx_head;
+	uint8_t next = (head + 1) & (TX_RING_SIZE - 1);
+
+	// only a buffer allocated from the pool and filled can be queued
+	if (!_packet_pool || !_packet_pool->length(handle) || (next == _tx_free)) {
+		return false;
+	}
+
+	// the driver owns the handle until the payload is sent or dropped
+	_tx_ring[head].length = _packet_pool->length(handle);
+	_tx_ring[head].ack = ack;
+	_tx_ring[head].handle = handle;
+	__DMB();
+	_tx_head = next;
+
+	if (_tx_streaming && _event_queue) {
+		_event_queue->call(callback(this, &NRF24L01::tx_refill));
+	}
+
+	return true;
+}
+
+uint8_t NRF24L01::tx_pending(void)
+{
+	return (_tx_head - _tx_tail) & (TX_RING_SIZE - 1);
+}
+
+// payload loaded in the Tx FIFO: its load time is kept until it leaves the
+// FIFO to measure its latency, and for a Tx stream payload its ring slot or
+// pool buffer, to load it again after MAX_RT
+void NRF24L01::tx_loaded(bool ack, uint8_t length, uint8_t slot, PacketPool::Handle handle)
+{
+	TxLoaded *loaded = NULL;
+
+	_statistics.tx_packets++;
+
+	// a fourth payload could be loaded: the oldest one was sent
+	if (_tx_loaded_count == 3) {
+		tx_completed(1, _tx_ds_timestamp);
+	}
+	loaded = &_tx_loaded[(_tx_loaded_head + _tx_loaded_count) % 3];
+	loaded->ack = ack;
+	loaded->length = length;
+	loaded->slot = slot;
+	loaded->handle = handle;
+	loaded->timestamp = us_ticker_read();
+	_tx_loaded_count++;
+}
+
+void NRF24L01::tx_unloaded(void)
+{
+	TxLoaded *loaded = &_tx_loaded[_tx_loaded_head];
+
+	// ring slots are loaded and freed in order
+	if (loaded->slot < TX_RING_SIZE) {
+		__DMB();
+		_tx_free = (loaded->slot + 1) & (TX_RING_SIZE - 1);
+	}
+	if ((loaded->handle != PacketPool::INVALID_HANDLE) && _packet_pool) {
+		_packet_pool->release(loaded->handle);
+	}
+	_tx_loaded_head = (_tx_loaded_head + 1) % 3;
+	_tx_loaded_count--;
+}
+
+// MAX_RT stops the Tx FIFO on its failed head, which only a flush removes:
+// the payloads behind it are loaded again from their ring slot or pool
+// buffer, the ones sent without the Tx ring are dropped too
+void NRF24L01::tx_drop_failed(void)
+{
+	uint8_t loaded = 3;
+	uint8_t count = 0;
+	TxLoaded reload;
+	PacketPool::Buffer *buffer = NULL;
+	char probe = 0;
+
+	// without TX_FULL, 1 or 2 payloads are left: a probe payload fills the
+	// FIFO in the later case only, as told by the STATUS of the flush
+	if (!tx_fifo_full()) {
+		spi_write_payload(&probe, 1);
+		loaded = (spi_single_write(static_cast<uint8_t>(RegisterOperation::OP_FLUSH_TX)) & 0x01) ? 2 : 1;
+	} else {
+		spi_single_write(static_cast<uint8_t>(RegisterOperation::OP_FLUSH_TX));
+	}
+
+	// the Tx FIFO holds the last loaded payloads, the older ones were sent
+	if (_tx_loaded_count > loaded) {
+		tx_completed(_tx_loaded_count - loaded, _tx_ds_timestamp);
+	}
+	if (_tx_loaded_count) {
+		tx_unloaded();
+	}
+	_statistics.tx_dropped++;
+
+	// each payload is taken out and put back behind the others once loaded
+	count = _tx_loaded_count;
+	for (uint8_t i = 0; i < count; i++) {
+		reload = _tx_loaded[_tx_loaded_head];
+		_tx_loaded_head = (_tx_loaded_head + 1) % 3;
+		_tx_loaded_count--;
+
+		buffer = (reload.handle != PacketPool::INVALID_HANDLE) ? _packet_pool->buffer(reload.handle) : NULL;
+		if (buffer) {
+			buffer->frame[0] = static_cast<char>(reload.ack ?
+					RegisterOperation::OP_TX : RegisterOperation::OP_TX_NOACK);
+			spi_transfer_frame(buffer->frame, reload.length, false);
+		} else if ((reload.handle == PacketPool::INVALID_HANDLE) && (reload.slot < TX_RING_SIZE)) {
+			spi_write_payload((const char *)_tx_ring[reload.slot].payload, reload.length,
+					reload.ack ? RegisterOperation::OP_TX : RegisterOperation::OP_TX_NOACK);
+		} else {
+			_statistics.tx_dropped++;
+			continue;
+		}
+		_tx_loaded[(_tx_loaded_head + _tx_loaded_count) % 3] = reload;
+		_tx_loaded_count++;
+	}
+}
+
+void NRF24L01::adapt_retransmit(uint8_t observe, bool lost)
+{
+	uint8_t reg_setup_retr = 0;
+	uint8_t ard = 0;
+	uint8_t min_ard = 0;
+	uint8_t arc = 0;
+	uint8_t max_arc_cnt = 0;
+
+	// keep the retransmit counts of the last 8 packets, a nibble each
+	_retransmit_history = (_retransmit_history << 4) | (observe & 0x0F);
+	for (uint8_t i = 0; i < 8; i++) {
+		if (((_retransmit_history >> (4 * i)) & 0x0F) > max_arc_cnt) {
+			max_arc_cnt = (_retransmit_history >> (4 * i)) & 0x0F;
+		}
+	}
+
+	reg_setup_retr = register_value(RegisterAddress::REG_SETUP_RETR);
+	ard = reg_setup_retr >> 4;
+	min_ard = (minimum_retransmit_delay() / RETRANSMIT_DELAY_STEP) - 1;
+
+	if (lost) {
+		// ACKs are missed: give the receiver more time, up to 4 extra steps
+		if (ard < min_ard + 4) {
+			ard++;
+		}
+		arc = _retransmit_count;
+	} else {
+		// retries beyond the recent worst case cannot help, keep a margin
+		arc = max_arc_cnt + 2;
+		if (arc > _retransmit_count) {
+			arc = _retransmit_count;
+		}
+		if ((max_arc_cnt == 0) && (ard > min_ard)) {
+			ard--;
+		}
+	}
+
+	// only written when changed, thanks to the register cache
+	update_register(RegisterAddress::REG_SETUP_RETR, (ard << 4) | arc);
+}
+
+void NRF24L01::update_tx_statistics(uint8_t observe, bool lost)
+{
+	uint8_t plos_cnt = observe >> 4;
+
+	_statistics.tx_retransmits += observe & 0x0F;
+
+	// PLOS_CNT saturates at 15 and is reset by a RF_CH write
+	if (plos_cnt >= _plos_cnt) {
+		_statistics.tx_lost += plos_cnt - _plos_cnt;
+	} else {
+		_statistics.tx_lost += plos_cnt;
+	}
+	_plos_cnt = plos_cnt;
+
+	if (lost) {
+		_statistics.tx_max_retransmit++;
+	}
+}
+
+// payloads which left the Tx FIFO, oldest first, with their latency up to
+// the TX_DS seen at timestamp
+void NRF24L01::tx_completed(uint8_t count, uint32_t timestamp)
+{
+	uint32_t latency = 0;
+	uint8_t bucket = 0;
+
+	for (; count && _tx_loaded_count; count--) {
+		latency = (timestamp - _tx_loaded[_tx_loaded_head].timestamp) / 250;
+		bucket = 0;
+		while (latency && (bucket < 7)) {
+			latency >>= 1;
+			bucket++;
+		}
+		_statistics.tx_latency[bucket]++;
+		_statistics.tx_data_sent++;
+		tx_unloaded();
+	}
+}
+
+// TX_DS tells that the oldest payload was sent at least: the ones sent
+// before TX_DS was cleared are counted once a payload is loaded in their
+// place, or once the Tx FIFO is empty, see tx_check_empty()
+void NRF24L01::tx_data_sent(uint32_t timestamp)
+{
+	_tx_ds_timestamp = timestamp;
+
+	if (!_tx_loaded_count) {
+		// a payload loaded out of sight of the driver
+		_statistics.tx_data_sent++;
+		return;
+	}
+	tx_completed(1, timestamp);
+}
+
+void NRF24L01::tx_check_empty(void)
+{
+	if (_tx_loaded_count && (fifo_status_register() & 0x10)) {
+		tx_completed(_tx_loaded_count, _tx_ds_timestamp);
+		// a TX_DS still set belongs to the payloads just completed
+		if (_status & static_cast<uint8_t>(RegisterAddress::REG_STATUS_TX_DS)) {
+			spi_write_register(RegisterAddress::REG_STATUS,
+					static_cast<uint8_t>(RegisterAddress::REG_STATUS_TX_DS));
+		}
+	}
+}
+
+void NRF24L01::attach_engines(EventQueue *queue)
+{
+	// grouped radios are serviced by the group dispatcher
+	_event_queue = _group ? _group->event_queue() : queue;
+
+	_irq.fall(callback(this, &NRF24L01::irq_handler));
+	_irq.enable_irq();
+
+	// process events pending before the engine was started
+	_irq_timestamp = us_ticker_read();
+	if (_group) {
+		_group->notify(_group_index);
+	} else {
+		_event_queue->call(callback(this, &NRF24L01::process_interrupts));
+	}
+}
+
+void NRF24L01::detach_engines(void)
+{
+	if (!_rx_engine && !_tx_streaming) {
+		_irq.fall(nullptr);
+		_irq.disable_irq();
+		_event_queue = NULL;
+	}
+}
+
+void NRF24L01::irq_handler(void)
+{
+	_irq_timestamp = us_ticker_read();
+	if (_group) {
+		_group->notify(_group_index);
+	} else if (_event_queue) {
+		_event_queue->call(callback(this, &NRF24L01::process_interrupts));
+	}
+}
+
+void NRF24L01::process_interrupts(void)
+{
+	uint32_t now = us_ticker_read();
+	uint8_t status = 0;
+	uint8_t fifo_status = 0;
+	bool fifo_status_read = false;
+	uint8_t observe = 0;
+
+	// a transaction started after the interrupt already gave its STATUS
+	if ((now - _status_time) < (now - _irq_timestamp)) {
+		status = _status & ~_status_cleared;
+	} else if (_rx_engine) {
+		// STATUS comes with FIFO_STATUS, which tells RX_FULL
+		fifo_status = fifo_status_register();
+		fifo_status_read = true;
+		status = _status;
+	} else {
+		status = status_register();
+	}
+
+	do {
+		if (_rx_engine && (((status >> 1) & 0x07) < MAX_DATA_PIPE)) {
+			if (!fifo_status_read) {
+				fifo_status = fifo_status_register();
+			}
+			rx_drain(status, fifo_status & 0x02);
+		}
+
+		if (_tx_streaming) {
+			if (status & static_cast<uint8_t>(RegisterAddress::REG_STATUS_TX_DS)) {
+				observe = observe_tx();
+				update_tx_statistics(observe, false);
+				if (_adaptive_retransmit) {
+					adapt_retransmit(observe, false);
+				}
+				// clear TX_DS only
+				spi_write_register(RegisterAddress::REG_STATUS,
+						static_cast<uint8_t>(RegisterAddress::REG_STATUS_TX_DS));
+				tx_data_sent(_irq_timestamp);
+			}
+			if (status & static_cast<uint8_t>(RegisterAddress::REG_STATUS_MAX_RT)) {
+				observe = observe_tx();
+				update_tx_statistics(observe, true);
+				if (_adaptive_retransmit) {
+					adapt_retransmit(observe, true);
+				}
+				// the failed payload would block the Tx FIFO: drop it alone
+				tx_drop_failed();
+				spi_write_register(RegisterAddress::REG_STATUS,
+						static_cast<uint8_t>(RegisterAddress::REG_STATUS_MAX_RT));
+			}
+			tx_refill();
+			// the Tx FIFO could not be filled: it may have been emptied
+			if ((status & static_cast<uint8_t>(RegisterAddress::REG_STATUS_TX_DS)) && !tx_pending()) {
+				tx_check_empty();
+			}
+		}
+
+		// send_packet() outcome, its flags are left to the application
+		if ((status & 0x30) && _tx_on_air) {
+			tx_outcome();
+		}
+
+		// a flag raised meanwhile holds IRQ low, no falling edge will
+		// follow: the last transaction tells the flags still set, the
+		// engines may have been stopped by a callback
+		status = _status & ~_status_cleared;
+		fifo_status_read = false;
+	} while ((_rx_engine && (((status >> 1) & 0x07) < MAX_DATA_PIPE)) || (_tx_streaming && (status & 0x30)));
+}
+
+void NRF24L01::rx_drain(uint8_t status, bool rx_full)
+{
+	uint8_t pipe = 0;
+	uint8_t head = 0;
+	uint8_t next = 0;
+	uint8_t length = 0;
+	bool received = false;
+	char discard[MAX_PAYLOAD_SIZE];
+	PacketPool::Handle handle = PacketPool::INVALID_HANDLE;
+	PacketPool::Buffer *buffer = NULL;
+	RxPacket packet;
+
+	pipe = (status >> 1) & 0x07;
+
+	// RX_P_NO is 0b111 once the Rx FIFO is empty
+	while (pipe < MAX_DATA_PIPE) {
+		head = _rx_head;
+		next = (head + 1) & (RX_RING_SIZE - 1);
+		handle = PacketPool::INVALID_HANDLE;
+
+		length = rx_payload_length(pipe);
+		if (_packet_pool && !_pipe_handlers[pipe] && (length <= MAX_PAYLOAD_SIZE) && (next != _rx_tail)) {
+			handle = _packet_pool->allocate();
+		}
+
+		if (length > MAX_PAYLOAD_SIZE) {
+			// corrupted payload, Rx FIFO has been flushed
+			_statistics.rx_corrupt++;
+		} else if (_pipe_handlers[pipe]) {
+			// dispatched from the handler table, the ring is bypassed
+			packet.timestamp = _irq_timestamp;
+			packet.pipe = pipe;
+			packet.length = length;
+			spi_read_payload((char *)packet.payload, length);
+			_statistics.rx_packets[pipe]++;
+			_pipe_handlers[pipe](packet);
+		} else if ((next == _rx_tail) || (_packet_pool && (handle == PacketPool::INVALID_HANDLE))) {
+			// ring or pool full: drop the packet to keep the Rx FIFO flowing
+			spi_read_payload(discard, length);
+			_statistics.rx_dropped++;
+		} else if (handle != PacketPool::INVALID_HANDLE) {
+			// the payload is clocked straight into the pool buffer
+			buffer = _packet_pool->buffer(handle);
+			buffer->timestamp = _irq_timestamp;
+			buffer->pipe = pipe;
+			buffer->length = length;
+			buffer->frame[0] = static_cast<char>(RegisterOperation::OP_RX);
+			spi_transfer_frame(buffer->frame, length, true);
+			_rx_handles[head] = handle;
+			__DMB();
+			_rx_head = next;
+			_statistics.rx_packets[pipe]++;
+			received = true;
+		} else {
+			_rx_handles[head] = PacketPool::INVALID_HANDLE;
+			_rx_ring[head].timestamp = _irq_timestamp;
+			_rx_ring[head].pipe = pipe;
+			_rx_ring[head].length = length;
+			spi_read_payload((char *)_rx_ring[head].payload, length);
+			// publish the slot only once the packet has been written
+			__DMB();
+			_rx_head = next;
+			_statistics.rx_packets[pipe]++;
+			received = true;
+		}
+
+		// clear RX_DR only, the STATUS clocked out gives the next pipe
+		spi_write_register(RegisterAddress::REG_STATUS,
+				static_cast<uint8_t>(RegisterAddress::REG_STATUS_RX_DR));
+		status = _status;
+		pipe = (status >> 1) & 0x07;
+	}
+
+	if (rx_full) {
+		_statistics.rx_fifo_full++;
+	}
+
+	if (received && _rx_callback) {
+		_rx_callback();
+	}
+}
+
+void NRF24L01::tx_refill(void)
+{
+	uint8_t tail = _tx_tail;
+	PacketPool::Buffer *buffer = NULL;
+
+	// keep the 3 levels Tx FIFO loaded until STATUS reports TX_FULL
+	while ((tail != _tx_head) && !tx_fifo_full()) {
+		if (!_tx_ring[tail].ack) {
+			// broadcast frames never wait on retransmits
+			set_dynamic_ack(true);
+		}
+		if (_tx_ring[tail].handle != PacketPool::INVALID_HANDLE) {
+			buffer = _packet_pool->buffer(_tx_ring[tail].handle);
+			if (!buffer) {
+				// released by the application while queued: dropped
+				if (_tx_free == tail) {
+					_tx_free = (tail + 1) & (TX_RING_SIZE - 1);
+				}
+				tail = (tail + 1) & (TX_RING_SIZE - 1);
+				__DMB();
+				_tx_tail = tail;
+				continue;
+			}
+			// clocked straight from the pool buffer, given back once sent
+			buffer->frame[0] = static_cast<char>(_tx_ring[tail].ack ?
+					RegisterOperation::OP_TX : RegisterOperation::OP_TX_NOACK);
+			spi_transfer_frame(buffer->frame, _tx_ring[tail].length, false);
+			tx_loaded(_tx_ring[tail].ack, _tx_ring[tail].length, tail, _tx_ring[tail].handle);
+		} else {
+			spi_write_payload((const char *)_tx_ring[tail].payload, _tx_ring[tail].length,
+					_tx_ring[tail].ack ? RegisterOperation::OP_TX : RegisterOperation::OP_TX_NOACK);
+			tx_loaded(_tx_ring[tail].ack, _tx_ring[tail].length, tail);
+		}
+
+		tail = (tail + 1) & (TX_RING_SIZE - 1);
+		// the slot is kept until the payload is sent, see tx_unloaded()
+		__DMB();
+		_tx_tail = tail;
+	}
 }
 
 void NRF24L01::set_interrupt(InterruptMode interrupt_mode)
 {
-	uint8_t register_value = 0xff;
+	uint8_t reg_config = 0xff;
 
-	register_value = spi_read_register(RegisterAddress::REG_CONFIG);
+	reg_config = register_value(RegisterAddress::REG_CONFIG);
 
 	// disable all interrupts, force to 1 to disable
-	register_value |= 0x70;
+	reg_config |= 0x70;
 
 	switch (interrupt_mode) {
 		case InterruptMode::NONE:
 			// already configured
 			break;
 		case InterruptMode::RX_ONLY:
-			register_value &= 0x3F;
+			reg_config &= 0x3F;
 			break;
 		case InterruptMode::TX_ONLY:
-			register_value &= 0x5F;
+			reg_config &= 0x5F;
 			break;
 		case InterruptMode::RX_TX:
-			register_value &= 0x1F;
+			reg_config &= 0x1F;
 			break;
 		case InterruptMode::RETRANSMIT:
-			register_value &= 0x6F;
+			reg_config &= 0x6F;
 			break;
 		case InterruptMode::TX_RETRANSMIT:
-			register_value &= 0x4F;
+			reg_config &= 0x4F;
 			break;
 	}
 
-	spi_write_register(RegisterAddress::REG_CONFIG, register_value);
+	update_register(RegisterAddress::REG_CONFIG, reg_config);
 
 }
 
 void NRF24L01::start_listening(void)
 {
 	flush_rx();
+	if (_ce_pulse || _tx_on_air) {
+		// a payload sent by send_packet() goes first: the Tx FIFO flush
+		// and CE wait for its outcome, see tx_outcome()
+		_listen_deferred = true;
+		return;
+	}
 	flush_tx();
 	set_com_ce(1);
 }
@@ -144,13 +950,14 @@ void NRF24L01::stop_listening(void)
 void NRF24L01::set_tx_address(uint8_t *tx_addr)
 {
 	spi_write_register(RegisterAddress::REG_TX_ADDR, (const char *)tx_addr, 5);
+	memcpy(_tx_address, tx_addr, 5);
 }
 
 void NRF24L01::set_crc(CRCwidth crc_width)
 {
 	int8_t reg_config = 0;
 	// read current status of CONFIG register
-	reg_config = spi_read_register(RegisterAddress::REG_CONFIG);
+	reg_config = register_value(RegisterAddress::REG_CONFIG);
 
 	switch (crc_width) {
 		case CRCwidth::NONE:
@@ -171,29 +978,41 @@ void NRF24L01::set_crc(CRCwidth crc_width)
 			break;
 	}
 	// write new value
-	spi_write_register(RegisterAddress::REG_CONFIG, reg_config);
+	update_register(RegisterAddress::REG_CONFIG, reg_config);
+}
+
+NRF24L01::CRCwidth NRF24L01::crc_width(void)
+{
+	uint8_t reg_config = register_value(RegisterAddress::REG_CONFIG);
+
+	// EN_CRC is bit 3, CRCO is bit 2
+	if (!(reg_config & (1 << 3))) {
+		return CRCwidth::NONE;
+	}
+
+	return (reg_config & (1 << 2)) ? CRCwidth::_16bits : CRCwidth::_8bits;
 }
 
 void NRF24L01::power_up(void)
 {
 	uint8_t reg_config = 0;
 	// read current status of CONFIG register
-	reg_config = spi_read_register(RegisterAddress::REG_CONFIG);
+	reg_config = register_value(RegisterAddress::REG_CONFIG);
 	// power up
 	reg_config |= (1 << 1);
 	// write new value config register
-	spi_write_register(RegisterAddress::REG_CONFIG, reg_config);
+	write_config(reg_config);
 }
 
 void NRF24L01::power_down(void)
 {
 	uint8_t reg_config = 0;
 	// read current status of CONFIG register
-	reg_config = spi_read_register(RegisterAddress::REG_CONFIG);
+	reg_config = register_value(RegisterAddress::REG_CONFIG);
 	// power down
 	reg_config &= 0xFD;
 	// write new value config register
-	spi_write_register(RegisterAddress::REG_CONFIG, reg_config);
+	write_config(reg_config);
 	// set mode
 	_mode = OperationMode::POWER_DOWN;
 }
@@ -202,16 +1021,16 @@ void NRF24L01::set_mode(OperationMode mode)
 {
 	uint8_t reg_config = 0;
 	// read current status of CONFIG register
-	reg_config = spi_read_register(RegisterAddress::REG_CONFIG);
+	reg_config = register_value(RegisterAddress::REG_CONFIG);
 	if (mode == OperationMode::RECEIVER) {
 		// Rx control
 		reg_config |= (1 << 0);
 	} else {
 		// Tx control
-		reg_config &= 0xF7;
+		reg_config &= 0xFE;
 	}
 	// write new value config register
-	spi_write_register(RegisterAddress::REG_CONFIG, reg_config);
+	write_config(reg_config);
 
 	_mode = mode;
 }
@@ -225,7 +1044,7 @@ void NRF24L01::set_power_up_and_mode(OperationMode mode)
 {
 	uint8_t reg_config = 0;
 	// read current status of CONFIG register
-	reg_config = spi_read_register(RegisterAddress::REG_CONFIG);
+	reg_config = register_value(RegisterAddress::REG_CONFIG);
 
 	if (mode == OperationMode::RECEIVER) {
 		// Rx control
@@ -235,62 +1054,207 @@ void NRF24L01::set_power_up_and_mode(OperationMode mode)
 		reg_config = ((reg_config & 0xEC) | 0x02);
 	}
 	// write new value config register
-	spi_write_register(RegisterAddress::REG_CONFIG, reg_config);
+	write_config(reg_config);
 }
 
-void NRF24L01::set_auto_acknowledgement(bool enable)
+NRF24L01::RadioState NRF24L01::radio_state(bool from_hardware)
 {
-	if (enable) {
-		spi_write_register(RegisterAddress::REG_EN_AA, 0x3F);
-	} else {
-		spi_write_register(RegisterAddress::REG_EN_AA, 0x00);
+	uint8_t reg_config = register_value(RegisterAddress::REG_CONFIG);
+
+	if (!(reg_config & (1 << 1))) {
+		return RadioState::POWER_DOWN;
+	}
+	if (!com_ce() || _powering_up) {
+		// a CE pulse transmission ends in Standby-I, seen from CE only
+		return RadioState::STANDBY_I;
 	}
+	if (reg_config & (1 << 0)) {
+		return RadioState::RX;
+	}
+	// CE held high in Tx mode: Standby-II once the Tx FIFO is empty
+	if (from_hardware && (fifo_status_register() & (1 << 4))) {
+		return RadioState::STANDBY_II;
+	}
+
+	return RadioState::TX;
 }
 
-void NRF24L01::set_auto_acknowledgement(uint8_t pipe, bool enable)
+bool NRF24L01::ready(void)
 {
-	uint8_t reg_en_aa = 0;
-
-	if (pipe <= MAX_DATA_PIPE) {
-		// read current value register
-		reg_en_aa = spi_read_register(RegisterAddress::REG_EN_AA);
-		// format new value
-		if (enable) {
-			reg_en_aa |= (1 << pipe);
-		} else {
-			reg_en_aa &= ~(1 << pipe);
-		}
-		//write new value register
-		spi_write_register(RegisterAddress::REG_EN_AA, reg_en_aa);
-	}
+	return (time_to_ready() == 0);
 }
 
-void NRF24L01::set_payload_size(RxAddressPipe rx_addr_pipe, uint8_t payload_size)
+uint32_t NRF24L01::time_to_ready(void)
+{
+	uint32_t now = us_ticker_read();
+	uint32_t elapsed = 0;
+
+	if (_powering_up) {
+		elapsed = now - _power_up_time;
+		if (elapsed < POWER_UP_TIME) {
+			// Tx/Rx settling only starts from Standby-I
+			return POWER_UP_TIME - elapsed + (com_ce() ? SETTLING_TIME : 0);
+		}
+		_powering_up = false;
+		// CE raised while powering up: the settling started in Standby-I
+		if ((now - _ce_time) > (elapsed - POWER_UP_TIME)) {
+			_ce_time = _power_up_time + POWER_UP_TIME;
+		}
+	}
+	if (com_ce() && (register_value(RegisterAddress::REG_CONFIG) & (1 << 1))) {
+		elapsed = now - _ce_time;
+		if (elapsed < SETTLING_TIME) {
+			return SETTLING_TIME - elapsed;
+		}
+	}
+
+	return 0;
+}
+
+void NRF24L01::write_config(uint8_t reg_config)
+{
+	uint8_t address = static_cast<uint8_t>(RegisterAddress::REG_CONFIG);
+	uint8_t previous = register_value(RegisterAddress::REG_CONFIG);
+
+	if (_ce_pulse) {
+		// a PRIM_RX or PWR_UP change would cut the CE pulse short: the cache
+		// holds the new value until the pulse ends, see ce_pulse_end()
+		if (!_config_deferred) {
+			_config_previous = previous;
+		}
+		_registers[address] = reg_config;
+		_config_deferred = true;
+		return;
+	}
+
+	// the transition times are tracked instead of waited for, see
+	// time_to_ready()
+	if (!(reg_config & (1 << 1))) {
+		_powering_up = false;
+	} else if (!(previous & (1 << 1))) {
+		_powering_up = true;
+		_power_up_time = us_ticker_read();
+	}
+
+	if (com_ce() && ((previous ^ reg_config) & (1 << 0))) {
+		// Rx/Tx turnaround through Standby-I: CE is only low for the
+		// CONFIG write, the chip settles again on CE high
+		_com_ce = 0;
+		spi_write_register(RegisterAddress::REG_CONFIG, reg_config);
+		_com_ce = 1;
+		_ce_time = us_ticker_read();
+		_ce_rising = true;
+
+		// written through the shadow register cache, nothing left to sync
+		_registers[address] = reg_config;
+		_dirty_registers &= ~(1UL << address);
+	} else {
+		update_register(RegisterAddress::REG_CONFIG, reg_config);
+	}
+}
+
+void NRF24L01::set_auto_acknowledgement(bool enable)
+{
+	if (enable) {
+		update_register(RegisterAddress::REG_EN_AA, 0x3F);
+	} else {
+		update_register(RegisterAddress::REG_EN_AA, 0x00);
+	}
+}
+
+void NRF24L01::set_auto_acknowledgement(uint8_t pipe, bool enable)
+{
+	uint8_t reg_en_aa = 0;
+
+	if (pipe < MAX_DATA_PIPE) {
+		// read current value register
+		reg_en_aa = register_value(RegisterAddress::REG_EN_AA);
+		// format new value
+		if (enable) {
+			reg_en_aa |= (1 << pipe);
+		} else {
+			reg_en_aa &= ~(1 << pipe);
+		}
+		//write new value register
+		update_register(RegisterAddress::REG_EN_AA, reg_en_aa);
+	}
+}
+
+void NRF24L01::set_auto_retransmit(uint16_t delay, uint8_t count)
+{
+	uint8_t ard = 0;
+
+	// ARD: 250 µs to 4000 µs by 250 µs steps, rounded up
+	if (delay > RETRANSMIT_DELAY_STEP) {
+		ard = (delay - 1) / RETRANSMIT_DELAY_STEP;
+	}
+	if (ard > 0x0F) {
+		ard = 0x0F;
+	}
+	if (count > MAX_RETRANSMIT_COUNT) {
+		count = MAX_RETRANSMIT_COUNT;
+	}
+	_retransmit_count = count;
+
+	update_register(RegisterAddress::REG_SETUP_RETR, (ard << 4) | count);
+}
+
+uint16_t NRF24L01::auto_retransmit_delay(void)
+{
+	return ((register_value(RegisterAddress::REG_SETUP_RETR) >> 4) + 1) * RETRANSMIT_DELAY_STEP;
+}
+
+uint8_t NRF24L01::auto_retransmit_count(void)
+{
+	return register_value(RegisterAddress::REG_SETUP_RETR) & 0x0F;
+}
+
+void NRF24L01::set_auto_retransmit_count(uint8_t count, uint8_t ack_payload_size)
+{
+	if (ack_payload_size > MAX_PAYLOAD_SIZE) {
+		ack_payload_size = MAX_PAYLOAD_SIZE;
+	}
+	_ack_payload_size = ack_payload_size;
+
+	set_auto_retransmit(minimum_retransmit_delay(), count);
+}
+
+void NRF24L01::set_adaptive_retransmit(bool enable)
+{
+	_adaptive_retransmit = enable;
+	_retransmit_history = 0;
+}
+
+uint16_t NRF24L01::minimum_retransmit_delay(void)
+{
+	// shortest ARD still receiving the ACK packet, from the datasheet
+	switch (_data_rate) {
+		case DataRate::_2MBPS:
+			return (_ack_payload_size <= 15) ? 250 : 500;
+		case DataRate::_1MBPS:
+			return (_ack_payload_size <= 5) ? 250 : 500;
+		case DataRate::_250KBPS:
+			if (_ack_payload_size == 0) {
+				return 500;
+			}
+			return 750 + ((_ack_payload_size - 1) / 8) * RETRANSMIT_DELAY_STEP;
+	}
+
+	return 4000;
+}
+
+uint8_t NRF24L01::observe_tx(void)
+{
+	return spi_read_register(RegisterAddress::REG_OBSERVE_TX);
+}
+
+void NRF24L01::set_payload_size(RxAddressPipe rx_addr_pipe, uint8_t payload_size)
 {
 	if (payload_size > MAX_PAYLOAD_SIZE) {
 		payload_size = MAX_PAYLOAD_SIZE;
 	}
 
-	switch(rx_addr_pipe) {
-		case RxAddressPipe::RX_ADDR_P0:
-			spi_write_register(RegisterAddress::REG_RX_PW_P0, payload_size);
-			break;
-		case RxAddressPipe::RX_ADDR_P1:
-			spi_write_register(RegisterAddress::REG_RX_PW_P1, payload_size);
-			break;
-		case RxAddressPipe::RX_ADDR_P2:
-			spi_write_register(RegisterAddress::REG_RX_PW_P2, payload_size);
-			break;
-		case RxAddressPipe::RX_ADDR_P3:
-			spi_write_register(RegisterAddress::REG_RX_PW_P3, payload_size);
-			break;
-		case RxAddressPipe::RX_ADDR_P4:
-			spi_write_register(RegisterAddress::REG_RX_PW_P4, payload_size);
-			break;
-		case RxAddressPipe::RX_ADDR_P5:
-			spi_write_register(RegisterAddress::REG_RX_PW_P5, payload_size);
-			break;
-	}
+	update_register(payload_size_register(rx_addr_pipe), payload_size);
 	_payload_size = payload_size;
 }
 
@@ -299,6 +1263,74 @@ uint8_t NRF24L01::payload_size(void)
 	return _payload_size;
 }
 
+void NRF24L01::set_dynamic_payload(bool enable)
+{
+	uint8_t reg_feature = 0;
+
+	reg_feature = register_value(RegisterAddress::REG_FEATURE);
+
+	if (enable) {
+		// dynamic payload length requires auto acknowledgement
+		set_auto_acknowledgement(true);
+		update_register(RegisterAddress::REG_DYNPD, 0x3F);
+		reg_feature |= (1 << 2);
+	} else {
+		update_register(RegisterAddress::REG_DYNPD, 0x00);
+		reg_feature &= 0xFB;
+	}
+	update_register(RegisterAddress::REG_FEATURE, reg_feature);
+}
+
+void NRF24L01::set_dynamic_payload(RxAddressPipe rx_addr_pipe, bool enable)
+{
+	uint8_t pipe = static_cast<uint8_t>(rx_addr_pipe);
+	uint8_t reg_dynpd = 0;
+
+	reg_dynpd = register_value(RegisterAddress::REG_DYNPD);
+
+	if (enable) {
+		// dynamic payload length requires auto acknowledgement
+		set_auto_acknowledgement(pipe, true);
+		reg_dynpd |= (1 << pipe);
+		// enable dynamic payload length feature
+		update_register(RegisterAddress::REG_FEATURE, register_value(RegisterAddress::REG_FEATURE) | (1 << 2));
+	} else {
+		reg_dynpd &= ~(1 << pipe);
+	}
+	update_register(RegisterAddress::REG_DYNPD, reg_dynpd);
+}
+
+void NRF24L01::set_ack_payload(bool enable)
+{
+	uint8_t reg_feature = 0;
+
+	if (enable) {
+		// payloads in acknowledgements require dynamic payload length
+		set_dynamic_payload(true);
+		reg_feature = register_value(RegisterAddress::REG_FEATURE) | (1 << 1);
+	} else {
+		reg_feature = register_value(RegisterAddress::REG_FEATURE) & 0xFD;
+	}
+	update_register(RegisterAddress::REG_FEATURE, reg_feature);
+}
+
+bool NRF24L01::write_ack_payload(RxAddressPipe rx_addr_pipe, const void *ack_packet, uint8_t length)
+{
+	uint8_t status = 0;
+
+	// manage payload length limit
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+
+	// ACK payloads share the 3 levels Tx FIFO, sent with the next ACK of the pipe
+	status = spi_transfer((static_cast<uint8_t>(RegisterOperation::OP_ACK_PAYLOAD) | static_cast<uint8_t>(rx_addr_pipe)),
+			(const char *)ack_packet, NULL, length);
+
+	// the payload is ignored when TX_FULL was set
+	return !(status & 0x01);
+}
+
 void NRF24L01::set_channel(uint8_t channel)
 {
 	uint8_t max_channel = 127;
@@ -306,16 +1338,60 @@ void NRF24L01::set_channel(uint8_t channel)
 	if (channel > max_channel) {
 		channel = max_channel;
 	}
+	update_register(RegisterAddress::REG_RF_CH, channel);
+}
+
+void NRF24L01::hop(uint8_t channel)
+{
+	uint8_t address = static_cast<uint8_t>(RegisterAddress::REG_RF_CH);
+	bool enabled = com_ce();
+
+	channel &= 0x7F;
+
+	// the synthesizer locks on the new channel through Standby-I: CE is
+	// only low for the RF_CH write, the chip settles again on CE high
+	if (enabled) {
+		_com_ce = 0;
+	}
 	spi_write_register(RegisterAddress::REG_RF_CH, channel);
+	if (enabled) {
+		_com_ce = 1;
+		_ce_time = us_ticker_read();
+		_ce_rising = true;
+	}
+
+	// written through the shadow register cache, nothing left to sync
+	_registers[address] = channel;
+	_dirty_registers &= ~(1UL << address);
+	_rf_frequency = MIN_RF_FREQUENCY + channel;
+	// PLOS_CNT is reset by a RF_CH write
+	_plos_cnt = 0;
 }
 
 void NRF24L01::set_com_ce(uint8_t level)
 {
-	_com_ce = level;
+	{
+		CriticalSectionLock lock;
+
+		// a CE pulse in progress ends first, the level is applied by
+		// ce_pulse_end()
+		if (_ce_pulse) {
+			_ce_after_pulse = level ? 1 : 0;
+			return;
+		}
+	}
 
-	if (level) {
-		wait_us(HARDWARE_DELAY);
+	if (level && !com_ce()) {
+		// the CE to CSN delay is enforced by the next SPI access only
+		_ce_time = us_ticker_read();
+		_ce_rising = true;
 	}
+	_com_ce = level;
+}
+
+uint8_t NRF24L01::com_ce(void)
+{
+	return _com_ce.read();
 }
 
 void NRF24L01::set_data_rate(DataRate data_rate)
@@ -323,32 +1399,23 @@ void NRF24L01::set_data_rate(DataRate data_rate)
 	uint8_t reg_rf_setup = 0;
 
 	// read current value of RF setup register
-	reg_rf_setup = spi_read_register(RegisterAddress::REG_RF_SETUP);
-	// clear rf data rate value to 1 Mbps
-	reg_rf_setup = (reg_rf_setup & 0xD7);
-	switch(data_rate) {
-		case DataRate::_250KBPS:
-			reg_rf_setup |= (1 << 5);
-			_data_rate = DataRate::_250KBPS;
-			break;
-		case DataRate::_1MBPS:
-			// nothing, already updating
-			_data_rate = DataRate::_1MBPS;
-			break;
-		case DataRate::_2MBPS:
-			reg_rf_setup |= (1 << 3);
-			_data_rate = DataRate::_2MBPS;
-			break;
-	}
+	reg_rf_setup = register_value(RegisterAddress::REG_RF_SETUP);
+	// clear rf data rate value to 1 Mbps and set the new one
+	reg_rf_setup = (reg_rf_setup & 0xD7) | data_rate_bits(data_rate);
+	_data_rate = data_rate;
 	// write new data rate
-	spi_write_register(RegisterAddress::REG_RF_SETUP, reg_rf_setup);
+	update_register(RegisterAddress::REG_RF_SETUP, reg_rf_setup);
 }
 
-NRF24L01::DataRate NRF24L01::data_rate(void)
+NRF24L01::DataRate NRF24L01::data_rate(bool from_hardware)
 {
 	uint8_t reg_rf_setup;
 
-	reg_rf_setup = spi_read_register(RegisterAddress::REG_RF_SETUP);
+	if (from_hardware) {
+		reg_rf_setup = fetch_register(RegisterAddress::REG_RF_SETUP);
+	} else {
+		reg_rf_setup = register_value(RegisterAddress::REG_RF_SETUP);
+	}
 
 	if (reg_rf_setup & 0x08) {
 		_data_rate = DataRate::_2MBPS;
@@ -363,33 +1430,8 @@ NRF24L01::DataRate NRF24L01::data_rate(void)
 
 void NRF24L01::attach_transmitting_payload(RxAddressPipe rx_address_pipe, uint8_t *hw_addr, uint8_t payload_size)
 {
-	switch(rx_address_pipe) {
-		case RxAddressPipe::RX_ADDR_P0:
-			// set rx addr to pipe 0
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P0, (const char *)hw_addr, 5);
-			break;
-		case RxAddressPipe::RX_ADDR_P1:
-			// set rx addr to pipe 1
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P1, (const char *)hw_addr, 5);
-			break;
-		case RxAddressPipe::RX_ADDR_P2:
-			// set rx addr to pipe 2
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P2, (const char *)hw_addr, 5);
-			break;
-		case RxAddressPipe::RX_ADDR_P3:
-			// set rx addr to pipe 3
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P3, (const char *)hw_addr, 5);
-			break;
-		case RxAddressPipe::RX_ADDR_P4:
-			// set rx addr to pipe 4
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P4, (const char *)hw_addr, 5);
-			break;
-		case RxAddressPipe::RX_ADDR_P5:
-			// set rx addr to pipe 5
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P5, (const char *)hw_addr, 5);
-			break;
-
-	}
+	// set rx addr to pipe
+	write_rx_address(rx_address_pipe, hw_addr);
 
 	set_tx_address(hw_addr);
 
@@ -402,117 +1444,414 @@ void NRF24L01::attach_receive_payload(RxAddressPipe rx_address_pipe, uint8_t *hw
 	// set payload
 	set_payload_size(rx_address_pipe , payload_size);
 
-	switch(rx_address_pipe) {
-		case RxAddressPipe::RX_ADDR_P0:
-			// set rx addr to pipe 0
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P0, (const char *)hw_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x01);
-			break;
-		case RxAddressPipe::RX_ADDR_P1:
-			// set rx addr to pipe 1
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P1, (const char *)hw_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x02);
-			break;
-		case RxAddressPipe::RX_ADDR_P2:
-			// set rx addr to pipe 2
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P2, (const char *)hw_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x04);
-			break;
-		case RxAddressPipe::RX_ADDR_P3:
-			// set rx addr to pipe 3
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P3, (const char *)hw_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x08);
-			break;
-		case RxAddressPipe::RX_ADDR_P4:
-			// set rx addr to pipe 4
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P4, (const char *)hw_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x10);
-			break;
-		case RxAddressPipe::RX_ADDR_P5:
-			// set rx addr to pipe 5
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P5, (const char *)hw_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x20);
-			break;
+	// set rx addr to pipe
+	write_rx_address(rx_address_pipe, hw_addr);
+	// enable rx addr, the other pipes are kept
+	enable_rx_pipe(rx_address_pipe, true);
+}
+
+void NRF24L01::attach_receive_address_to_pipe(RxAddressPipe rx_address_pipe, uint8_t *hw_rx_addr)
+{
+	// set rx addr to pipe
+	write_rx_address(rx_address_pipe, hw_rx_addr);
+	// enable rx addr, the other pipes are kept
+	enable_rx_pipe(rx_address_pipe, true);
+}
+
+void NRF24L01::set_rx_pipes(uint8_t pipes)
+{
+	// EN_RXADDR bitmap, any subset of the 6 pipes in a single write
+	update_register(RegisterAddress::REG_EN_RXADDR, pipes & 0x3F);
+}
+
+uint8_t NRF24L01::rx_pipes(void)
+{
+	return register_value(RegisterAddress::REG_EN_RXADDR);
+}
+
+void NRF24L01::enable_rx_pipe(RxAddressPipe rx_address_pipe, bool enable)
+{
+	uint8_t reg_en_rxaddr = register_value(RegisterAddress::REG_EN_RXADDR);
+
+	if (enable) {
+		reg_en_rxaddr |= (1 << static_cast<uint8_t>(rx_address_pipe));
+	} else {
+		reg_en_rxaddr &= ~(1 << static_cast<uint8_t>(rx_address_pipe));
+	}
+	update_register(RegisterAddress::REG_EN_RXADDR, reg_en_rxaddr);
+}
+
+void NRF24L01::attach_pipe_handler(RxAddressPipe rx_address_pipe, Callback<void(const RxPacket &)> func)
+{
+	// Rx engine packets of this pipe bypass the receive ring
+	_pipe_handlers[static_cast<uint8_t>(rx_address_pipe)] = func;
+}
+
+void NRF24L01::write_rx_address(RxAddressPipe rx_address_pipe, const uint8_t *address)
+{
+	// pipes 2 to 5 only hold their LSByte, the 4 others are the ones of pipe 1
+	spi_write_register(rx_address_register(rx_address_pipe), (const char *)address,
+			(rx_address_pipe > RxAddressPipe::RX_ADDR_P1) ? 1 : 5);
+
+	if (rx_address_pipe > RxAddressPipe::RX_ADDR_P1) {
+		_rx_address_lsb[static_cast<uint8_t>(rx_address_pipe) - 2] = address[0];
+	} else {
+		memcpy(_rx_address[static_cast<uint8_t>(rx_address_pipe)], address, 5);
+	}
+}
+
+void NRF24L01::send_packet(const void *tx_packet, uint8_t length)
+{
+	// a CE pulse in progress is extended instead, see start_transfer()
+	if (!_ce_pulse) {
+		set_com_ce(0);
+	}
+
+	// manage payload length limit
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+	spi_write_payload((const char *)tx_packet, length);
+	tx_loaded(true, length);
+
+	start_transfer();
+}
+
+void NRF24L01::send_packet(PacketPool::Handle handle)
+{
+	PacketPool::Buffer *buffer = _packet_pool ? _packet_pool->buffer(handle) : NULL;
+
+	if (!buffer || !buffer->length) {
+		return;
+	}
+
+	// a CE pulse in progress is extended instead, see start_transfer()
+	if (!_ce_pulse) {
+		set_com_ce(0);
+	}
+
+	buffer->frame[0] = static_cast<char>(RegisterOperation::OP_TX);
+	spi_transfer_frame(buffer->frame, buffer->length, false);
+	tx_loaded(true, buffer->length);
+	_packet_pool->release(handle);
+
+	start_transfer();
+}
+
+void NRF24L01::send_packet_noack(const void *tx_packet, uint8_t length)
+{
+	// no register access once enabled, thanks to the register cache
+	set_dynamic_ack(true);
+
+	if (!_ce_pulse) {
+		set_com_ce(0);
+	}
+
+	// manage payload length limit
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+	spi_write_payload((const char *)tx_packet, length, RegisterOperation::OP_TX_NOACK);
+	tx_loaded(false, length);
+
+	start_transfer();
+}
+
+void NRF24L01::load_packet(const void *tx_packet, uint8_t length, bool ack)
+{
+	// Tx FIFO only, CE starts the transmission
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+	if (ack) {
+		spi_write_payload((const char *)tx_packet, length);
+	} else {
+		set_dynamic_ack(true);
+		spi_write_payload((const char *)tx_packet, length, RegisterOperation::OP_TX_NOACK);
+	}
+	tx_loaded(ack, length);
+}
+
+void NRF24L01::set_dynamic_ack(bool enable)
+{
+	uint8_t reg_feature = 0;
+
+	reg_feature = register_value(RegisterAddress::REG_FEATURE);
+
+	if (enable) {
+		reg_feature |= (1 << 0);
+	} else {
+		reg_feature &= 0xFE;
+	}
+	update_register(RegisterAddress::REG_FEATURE, reg_feature);
+}
+
+void NRF24L01::start_transfer(void)
+{
+	uint32_t delay = 0;
+	CriticalSectionLock lock;
+
+	// in Tx mode only: the CE pulse is timed by a Timeout instead of
+	// spinning, a call during a pulse extends it
+	if (_ce_pulse) {
+		if (com_ce()) {
+			_ce_timeout.attach_us(callback(this, &NRF24L01::ce_pulse_end), TX_PULSE_DURATION);
+		}
+		return;
+	}
+
+	_ce_pulse = true;
+	// nothing goes on air from Rx mode
+	_tx_on_air = !(register_value(RegisterAddress::REG_CONFIG) & (1 << 0));
+	// a pulse during the power up would be lost
+	delay = time_to_ready();
+	if (delay) {
+		_ce_timeout.attach_us(callback(this, &NRF24L01::ce_pulse_start), delay);
+	} else {
+		ce_pulse_start();
+	}
+}
+
+void NRF24L01::ce_pulse_start(void)
+{
+	_com_ce = 1;
+	_ce_time = us_ticker_read();
+	_ce_rising = true;
+	_ce_timeout.attach_us(callback(this, &NRF24L01::ce_pulse_end), TX_PULSE_DURATION);
+}
+
+void NRF24L01::ce_pulse_end(void)
+{
+	// the changes held by the pulse run now: CE at once, CONFIG from the
+	// EventQueue or before the next SPI transaction
+	_com_ce = (_ce_after_pulse > 0) ? 1 : 0;
+	_ce_after_pulse = -1;
+	_ce_pulse = false;
+	if (_config_deferred && _event_queue) {
+		_event_queue->call(callback(this, &NRF24L01::write_deferred_config));
+	}
+}
+
+void NRF24L01::abort_ce_pulse(void)
+{
+	CriticalSectionLock lock;
+
+	if (_ce_pulse) {
+		_ce_timeout.detach();
+		_com_ce = 0;
+		_ce_pulse = false;
+	}
+}
+
+void NRF24L01::write_deferred_config(void)
+{
+	uint8_t reg_config = _registers[static_cast<uint8_t>(RegisterAddress::REG_CONFIG)];
+
+	if (!_config_deferred || _ce_pulse) {
+		return;
+	}
+	_config_deferred = false;
+	// written as if the change had just been made
+	_registers[static_cast<uint8_t>(RegisterAddress::REG_CONFIG)] = _config_previous;
+	write_config(reg_config);
+}
+
+void NRF24L01::tx_outcome(void)
+{
+	_tx_on_air = false;
+	if (_listen_deferred) {
+		_listen_deferred = false;
+		flush_tx();
+		set_com_ce(1);
+	}
+}
+
+void NRF24L01::read_packet(void *rx_packet, uint8_t length)
+{
+	// manage payload length limit
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+	spi_read_payload((char *)rx_packet, length);
+}
+
+#if DEVICE_SPI_ASYNCH
+/***************************************************************************
+ * asynchronous transfers
+ *
+ * Completion callbacks are called from interrupt context. The synchronous
+ * API must not be used while asynchronous transfers are pending, both share
+ * the SPI bus and the chip select line.
+ ***************************************************************************/
+bool NRF24L01::send_packet_async(const void *tx_packet, uint8_t length, Callback<void(int)> func)
+{
+	// manage payload length limit
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+
+	return async_enqueue(static_cast<uint8_t>(RegisterOperation::OP_TX), (const char *)tx_packet, NULL,
+			length, func);
+}
+
+bool NRF24L01::read_packet_async(void *rx_packet, uint8_t length, Callback<void(int)> func)
+{
+	// manage payload length limit
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+
+	return async_enqueue(static_cast<uint8_t>(RegisterOperation::OP_RX), NULL, (char *)rx_packet,
+			length, func);
+}
+
+bool NRF24L01::async_enqueue(uint8_t command, const char *tx_buffer, char *rx_buffer, uint8_t length,
+		Callback<void(int)> func)
+{
+	AsyncTransfer *transfer;
+	bool start = false;
+
+	{
+		CriticalSectionLock lock;
+
+		if (_async_count >= ASYNC_QUEUE_SIZE) {
+			return false;
+		}
+		transfer = &_async_queue[(_async_head + _async_count) % ASYNC_QUEUE_SIZE];
+
+		// the frame is owned by the descriptor until completion
+		transfer->tx_frame[0] = static_cast<char>(command);
+		if (tx_buffer) {
+			memcpy(&transfer->tx_frame[1], tx_buffer, length);
+		} else {
+			memset(&transfer->tx_frame[1], static_cast<uint8_t>(RegisterOperation::OP_NOP), length);
+		}
+		transfer->rx_buffer = rx_buffer;
+		transfer->length = length;
+		transfer->callback = func;
+
+		start = (_async_count == 0);
+		_async_count++;
+	}
+
+	if (start) {
+		async_start();
+	}
+
+	return true;
+}
+
+void NRF24L01::async_start(void)
+{
+	AsyncTransfer *transfer = &_async_queue[_async_head];
+	EventQueue *queue = _group ? _group->event_queue() : _event_queue;
+
+	// a bus held by another radio of the group starts the transfer again
+	// once released
+	if (_group && !_group->acquire(_group_index)) {
+		return;
+	}
+
+	if (transfer->tx_frame[0] == static_cast<char>(RegisterOperation::OP_TX)) {
+		set_com_ce(0);
+	}
+
+	spi_select();
+	if (_spi->transfer(transfer->tx_frame, transfer->length + 1, _async_rx_frame, transfer->length + 1,
+			callback(this, &NRF24L01::async_transfer_done), SPI_EVENT_COMPLETE) < 0) {
+		// the SPI peripheral runs another transfer: started again later
+		spi_deselect();
+		if (_group) {
+			_group->release();
+		}
+		if (queue) {
+			queue->call(callback(this, &NRF24L01::async_start));
+		} else {
+			_async_ce_timeout.attach_us(callback(this, &NRF24L01::async_start), ASYNC_RETRY_DELAY);
+		}
+		return;
+	}
+
+	if (transfer->tx_frame[0] == static_cast<char>(RegisterOperation::OP_TX)) {
+		tx_loaded(true, transfer->length);
+	}
+}
+
+void NRF24L01::async_transfer_done(int event)
+{
+	AsyncTransfer *transfer = &_async_queue[_async_head];
+
+	spi_deselect();
+	if (_group) {
+		_group->release();
+	}
+
+	capture_status(transfer->tx_frame[0], _async_rx_frame[0]);
+	_statistics.spi_transactions++;
+	_statistics.spi_bytes += transfer->length + 1;
+	_async_event = event;
+
+	if (transfer->rx_buffer) {
+		memcpy(transfer->rx_buffer, &_async_rx_frame[1], transfer->length);
+	}
+
+	if ((transfer->tx_frame[0] == static_cast<char>(RegisterOperation::OP_TX))
+			&& (event & SPI_EVENT_COMPLETE)) {
+		// CE pulse is ended by a timeout instead of spinning
+		_com_ce = 1;
+		_ce_time = us_ticker_read();
+		_ce_rising = true;
+		_async_ce_timeout.attach_us(callback(this, &NRF24L01::async_complete), TX_PULSE_DURATION);
+	} else {
+		async_complete();
 	}
 }
 
-void NRF24L01::attach_receive_address_to_pipe(RxAddressPipe rx_address_pipe, uint8_t *hw_rx_addr)
+void NRF24L01::async_complete(void)
 {
-	switch(rx_address_pipe) {
-		case RxAddressPipe::RX_ADDR_P0:
-			// set rx addr to pipe 0
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P0, (const char *)hw_rx_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x01);
-			break;
-		case RxAddressPipe::RX_ADDR_P1:
-			// set rx addr to pipe 1
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P1, (const char *)hw_rx_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x02);
-			break;
-		case RxAddressPipe::RX_ADDR_P2:
-			// set rx addr to pipe 2
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P2, (const char *)hw_rx_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x04);
-			break;
-		case RxAddressPipe::RX_ADDR_P3:
-			// set rx addr to pipe 3
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P3, (const char *)hw_rx_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x08);
-			break;
-		case RxAddressPipe::RX_ADDR_P4:
-			// set rx addr to pipe 4
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P4, (const char *)hw_rx_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x10);
-			break;
-		case RxAddressPipe::RX_ADDR_P5:
-			// set rx addr to pipe 5
-			spi_write_register(RegisterAddress::REG_RX_ADDR_P5, (const char *)hw_rx_addr, 5);
-			// enable rx addr
-			spi_write_register(RegisterAddress::REG_EN_RXADDR, 0x20);
-			break;
+	AsyncTransfer *transfer = &_async_queue[_async_head];
+	Callback<void(int)> func = transfer->callback;
+
+	if (transfer->tx_frame[0] == static_cast<char>(RegisterOperation::OP_TX)) {
+		_com_ce = 0;
 	}
-}
 
-void NRF24L01::send_packet(const void *tx_packet, uint8_t length)
-{
-	set_com_ce(0);
+	_async_head = (_async_head + 1) % ASYNC_QUEUE_SIZE;
+	_async_count--;
 
-	// manage payload length limit
-	if (length > MAX_PAYLOAD_SIZE) {
-		length = MAX_PAYLOAD_SIZE;
+	// chain the next queued transfer before notifying the user
+	if (_async_count) {
+		async_start();
 	}
-	spi_write_payload((const char *)tx_packet, length);
 
-	start_transfer();
+	if (func) {
+		func(_async_event);
+	}
 }
+#endif
 
-void NRF24L01::start_transfer(void)
+uint8_t NRF24L01::read_packet(void *rx_packet)
 {
-	//in Tx mode only
-	set_com_ce(1);
-	wait_us(20);
-	set_com_ce(0);
+	uint8_t status = 0;
+	uint8_t length = 0;
 
-}
+	status = status_register();
 
-void NRF24L01::read_packet(void *rx_packet, uint8_t length)
-{
-	// manage payload length limit
+	// Rx FIFO empty
+	if (((status >> 1) & 0x07) >= MAX_DATA_PIPE) {
+		return 0;
+	}
+
+	length = rx_payload_length((status >> 1) & 0x07);
 	if (length > MAX_PAYLOAD_SIZE) {
-		length = MAX_PAYLOAD_SIZE;
+		// corrupted payload, Rx FIFO has been flushed
+		_statistics.rx_corrupt++;
+		return 0;
 	}
 	spi_read_payload((char *)rx_packet, length);
+	_statistics.rx_packets[(status >> 1) & 0x07]++;
+
+	return length;
 }
 
 void NRF24L01::set_rf_frequency(uint16_t rf_frequency)
@@ -546,12 +1885,12 @@ void NRF24L01::set_rf_output_power(RFoutputPower rf_output_power)
 
 	// availbale only in the Tx mode
     if (_mode == OperationMode::TRANSCEIVER) {
-	    reg_rf_setup = spi_read_register(RegisterAddress::REG_RF_SETUP);
+	    reg_rf_setup = register_value(RegisterAddress::REG_RF_SETUP);
 		// clear concerned bits and format new value
-        reg_rf_setup = (reg_rf_setup & 0xF8);
-        reg_rf_setup = (reg_rf_setup | static_cast<uint8_t>(rf_output_power));
+        reg_rf_setup = (reg_rf_setup & 0xF9);
+        reg_rf_setup = (reg_rf_setup | rf_output_power_bits(rf_output_power));
         // set value register
-        spi_write_register(RegisterAddress::REG_RF_SETUP, reg_rf_setup);
+        update_register(RegisterAddress::REG_RF_SETUP, reg_rf_setup);
         _rf_output_power = rf_output_power;
 	 }
 }
@@ -569,7 +1908,31 @@ void NRF24L01::flush_rx(void)
 
 void NRF24L01::flush_tx(void)
 {
-	spi_single_write(static_cast<uint8_t>(RegisterOperation::OP_FLUSH_TX));
+	uint8_t dropped = _tx_loaded_count;
+	int8_t level = -1;
+
+	// an abort: a CE pulse in progress ends at once, its payload is
+	// flushed with the others
+	abort_ce_pulse();
+	if (spi_single_write(static_cast<uint8_t>(RegisterOperation::OP_FLUSH_TX)) & 0x20) {
+		// TX_DS not cleared yet: the oldest one was sent, counted on clear
+		if (dropped) {
+			dropped--;
+		}
+	}
+	_statistics.tx_dropped += dropped;
+	while (_tx_loaded_count) {
+		tx_unloaded();
+	}
+	_tx_on_air = false;
+	_listen_deferred = false;
+
+	// CE set during the pulse, once the Tx FIFO is empty
+	level = _ce_after_pulse;
+	_ce_after_pulse = -1;
+	if (level >= 0) {
+		set_com_ce(level);
+	}
 }
 
 void NRF24L01::tx_address(uint8_t *tx_addr)
@@ -579,26 +1942,13 @@ void NRF24L01::tx_address(uint8_t *tx_addr)
 
 void NRF24L01::rx_address(RxAddressPipe rx_address_pipe, uint8_t *rx_addr)
 {
-	switch(rx_address_pipe) {
-			case RxAddressPipe::RX_ADDR_P0:
-				spi_read_register(RegisterAddress::REG_RX_ADDR_P0, rx_addr, 5);
-				break;
-			case RxAddressPipe::RX_ADDR_P1:
-				spi_read_register(RegisterAddress::REG_RX_ADDR_P1, rx_addr, 5);
-				break;
-			case RxAddressPipe::RX_ADDR_P2:
-				spi_read_register(RegisterAddress::REG_RX_ADDR_P2, rx_addr, 5);
-				break;
-			case RxAddressPipe::RX_ADDR_P3:
-				spi_read_register(RegisterAddress::REG_RX_ADDR_P3, rx_addr, 5);
-				break;
-			case RxAddressPipe::RX_ADDR_P4:
-				spi_read_register(RegisterAddress::REG_RX_ADDR_P4, rx_addr, 5);
-				break;
-			case RxAddressPipe::RX_ADDR_P5:
-				spi_read_register(RegisterAddress::REG_RX_ADDR_P5, rx_addr, 5);
-				break;
-		}
+	if (rx_address_pipe > RxAddressPipe::RX_ADDR_P1) {
+		// shared MSBytes of pipe 1, own LSByte
+		spi_read_register(RegisterAddress::REG_RX_ADDR_P1, rx_addr, 5);
+		spi_read_register(rx_address_register(rx_address_pipe), rx_addr, 1);
+	} else {
+		spi_read_register(rx_address_register(rx_address_pipe), rx_addr, 5);
+	}
 }
 
 uint8_t NRF24L01::status_register(void)
@@ -606,191 +1956,554 @@ uint8_t NRF24L01::status_register(void)
 	return spi_single_write(static_cast<uint8_t>(RegisterOperation::OP_NOP));
 }
 
+uint8_t NRF24L01::cached_status(uint32_t *timestamp)
+{
+	// STATUS clocked out by the last transaction, no bus access
+	if (timestamp) {
+		*timestamp = _status_time;
+	}
+
+	return _status;
+}
+
 uint8_t NRF24L01::fifo_status_register(void)
 {
 	return spi_read_register(RegisterAddress::REG_FIFO_STATUS);
 }
 
-uint8_t NRF24L01::config_status_register(void)
+uint8_t NRF24L01::config_status_register(bool from_hardware)
+{
+	if (from_hardware) {
+		return fetch_register(RegisterAddress::REG_CONFIG);
+	}
+	return register_value(RegisterAddress::REG_CONFIG);
+}
+
+bool NRF24L01::received_power_detector(bool count)
+{
+	bool rpd = (spi_read_register(RegisterAddress::REG_RPD) & 0x01);
+
+	// surveys off the link channel keep their own counts
+	if (rpd && count) {
+		_statistics.rpd_hits++;
+	}
+
+	return rpd;
+}
+
+NRF24L01::Statistics NRF24L01::statistics(void)
+{
+	CriticalSectionLock lock;
+
+	return _statistics;
+}
+
+void NRF24L01::reset_statistics(void)
 {
-	return spi_read_register(RegisterAddress::REG_CONFIG);
+	CriticalSectionLock lock;
+
+	memset(&_statistics, 0, sizeof(_statistics));
 }
 
 /***************************************************************************
- * transport layer
+ * shadow register cache
  ***************************************************************************/
-void NRF24L01::spi_select(void)
+void NRF24L01::set_deferred_sync(bool enable)
 {
-	_com_cs = 0;
+	_deferred_sync = enable;
+
+	if (!enable) {
+		sync();
+	}
 }
 
-void NRF24L01::spi_deselect(void)
+void NRF24L01::sync(void)
 {
-	_com_cs = 1;
+	uint8_t address = 0;
+
+	// push only the registers changed since the last synchronization
+	while (_dirty_registers) {
+		if (_dirty_registers & (1UL << address)) {
+			spi_write_register(static_cast<RegisterAddress>(address), _registers[address]);
+			_dirty_registers &= ~(1UL << address);
+		}
+		address++;
+	}
 }
 
-void NRF24L01::spi_write_payload(const char *buffer, uint8_t length)
+void NRF24L01::refresh_registers(void)
 {
-#ifdef _SPI_API_WITHOUT_CS_
-	spi_select();
-	_spi->write(static_cast<uint8_t>(RegisterOperation::OP_TX));
-	while (length--) {
-		_spi->write(*buffer++);
+	// pending changes are lost: the chip is the reference
+	for (uint8_t address = 0; address < REGISTER_COUNT; address++) {
+		if (CACHED_REGISTERS_MASK & (1UL << address)) {
+			_registers[address] = spi_read_register(static_cast<RegisterAddress>(address));
+		}
 	}
-	spi_deselect();
-#else
-	static char *data;
-	static char resp[2];
+	_dirty_registers = 0;
+	_registers_valid = true;
+}
 
-	// create a dynamic buffer to use mbed spi API
-	data = new char[length];
+void NRF24L01::invalidate_registers(void)
+{
+	// next access reloads the whole register file (ie. after a brownout)
+	_dirty_registers = 0;
+	_registers_valid = false;
+}
 
-	// formatting data
-	data[0] = static_cast<char>(RegisterAddress::OP_TX);
+void NRF24L01::restore_registers(bool from_reset)
+{
+	uint8_t address = 0;
+	uint8_t pipe = 0;
+	bool ce = _ce_pulse ? (_ce_after_pulse > 0) : com_ce();
 
-	for (int i = 1; i < length; i++) {
-		data[i] = *buffer;
-		buffer++;
+	// nothing known to restore
+	if (!_registers_valid) {
+		return;
 	}
-	spi_select();
-	//TODO: ignore response?
-	_spi->write(data, length, resp, sizeof(resp));
-	spi_deselect();
 
-	delete data;
+	// the cache is the reference (ie. after a brownout), pending changes
+	// included: only the values differing from the power on reset ones are
+	// written after a reset, CONFIG last. A CE pulse is given up
+	abort_ce_pulse();
+	_ce_after_pulse = -1;
+	_config_deferred = false;
+	set_com_ce(0);
+	for (address = static_cast<uint8_t>(RegisterAddress::REG_EN_AA); address < REGISTER_COUNT; address++) {
+		if ((CACHED_REGISTERS_MASK & (1UL << address))
+				&& !(from_reset && (_registers[address] == RESET_REGISTERS[address]))) {
+			spi_write_register(static_cast<RegisterAddress>(address), _registers[address]);
+		}
+	}
+	if (!from_reset || !reset_address(_tx_address, RESET_TX_ADDRESS)) {
+		spi_write_register(RegisterAddress::REG_TX_ADDR, (const char *)_tx_address, 5);
+	}
+	if (!from_reset || !reset_address(_rx_address[0], RESET_TX_ADDRESS)) {
+		spi_write_register(RegisterAddress::REG_RX_ADDR_P0, (const char *)_rx_address[0], 5);
+	}
+	if (!from_reset || !reset_address(_rx_address[1], RESET_RX_ADDRESS)) {
+		spi_write_register(RegisterAddress::REG_RX_ADDR_P1, (const char *)_rx_address[1], 5);
+	}
+	for (pipe = 2; pipe < MAX_DATA_PIPE; pipe++) {
+		address = static_cast<uint8_t>(RegisterAddress::REG_RX_ADDR_P0) + pipe;
+		if (!from_reset || (_rx_address_lsb[pipe - 2] != RESET_REGISTERS[address])) {
+			spi_write_register(static_cast<RegisterAddress>(address), _rx_address_lsb[pipe - 2]);
+		}
+	}
+	spi_write_register(RegisterAddress::REG_CONFIG, _registers[0]);
+	_dirty_registers = 0;
+
+	// the previous power state is unknown, assume a full power up
+	_powering_up = _registers[0] & (1 << 1);
+	_power_up_time = us_ticker_read();
+	if (ce) {
+		set_com_ce(1);
+	}
+}
+
+uint8_t NRF24L01::check_health(void)
+{
+	uint32_t now = 0;
+	uint32_t progress = 0;
+	uint8_t fifo = 0;
+	uint8_t flags = 0;
+	uint8_t serviced = 0;
+	uint8_t faults = 0;
+	bool irq_idle = false;
+
+#if DEVICE_SPI_ASYNCH
+	// the bus belongs to the asynchronous transfers
+	if (_async_count) {
+		return 0;
+	}
 #endif
+
+	// STATUS is clocked out by the CONFIG read
+	_health_config = spi_read_register(RegisterAddress::REG_CONFIG);
+	flags = _status & 0x70;
+	fifo = fifo_status_register();
+	now = us_ticker_read();
+
+	// a change still pending in the register cache is not a fault
+	if (_registers_valid && !(_dirty_registers & 0x01) && !_config_deferred
+			&& (_health_config != _registers[0])) {
+		_health_flags = 0;
+		_tx_stalled = false;
+		return FAULT_CONFIG;
+	}
+
+	progress = _statistics.tx_packets + _statistics.tx_data_sent + _statistics.tx_max_retransmit;
+	irq_idle = (_irq_timestamp == _health_irq_timestamp);
+
+	// a flag seen by two checks without any interrupt or payload load in
+	// between outlived a whole period: the IRQ falling edge was lost, or
+	// MAX_RT is never cleared and blocks the Tx FIFO
+	if (_event_queue) {
+		serviced = (_rx_engine ? 0x40 : 0) | (_tx_streaming ? 0x30 : 0);
+	}
+	if ((flags & _health_flags & 0x10) && ((serviced & 0x10) ? irq_idle : (progress == _health_progress))) {
+		faults |= FAULT_MAX_RT;
+	} else if ((flags & _health_flags & serviced & ~_health_config) && irq_idle) {
+		// interrupt sources are the flags not masked in CONFIG
+		faults |= FAULT_IRQ;
+	}
+
+	// the Tx FIFO head is expected to be sent or dropped within a
+	// retransmit cycle
+	if ((fifo & 0x10) || (flags & 0x30) || (progress != _health_progress)) {
+		_tx_stalled = false;
+	} else if (!_tx_stalled) {
+		_tx_stalled = true;
+		_tx_stall_time = now;
+	} else if (((_health_config & 0x03) == (1 << 1)) && ((now - _tx_stall_time) >= tx_stall_time())) {
+		// Tx mode only, the Tx FIFO of a receiver holds ACK payloads. With
+		// CE low, the CE pulses were lost
+		if (com_ce()) {
+			faults |= FAULT_TX_STALL;
+		} else if (fifo & 0x20) {
+			faults |= FAULT_TX_FULL;
+		}
+	}
+	_health_flags = flags;
+	_health_progress = progress;
+	_health_irq_timestamp = _irq_timestamp;
+
+	if (faults) {
+		_health_flags = 0;
+		_tx_stalled = false;
+	}
+
+	return faults;
 }
 
-void NRF24L01::spi_read_payload(char* buffer, uint8_t length)
+void NRF24L01::recover(uint8_t faults)
 {
+	uint32_t now = us_ticker_read();
+	bool ce = false;
+
+	if (faults & FAULT_CONFIG) {
+		// a CONFIG back to its reset value tells that the whole register
+		// file and the FIFOs were reset: only the registers differing from
+		// their reset value are written again
+		restore_registers(_health_config == RESET_REGISTERS[0]);
+		while (_tx_loaded_count) {
+			tx_unloaded();
+		}
+	}
 
-#ifdef _SPI_API_WITHOUT_CS_
-	spi_select();
-	_spi->write(static_cast<uint8_t>(RegisterOperation::OP_RX));
-	while (length--) {
-		*buffer++ = _spi->write(static_cast<uint8_t>(RegisterOperation::OP_NOP));
+	if ((faults & (FAULT_TX_FULL | FAULT_TX_STALL)) || ((faults & FAULT_MAX_RT) && !_tx_streaming)) {
+		// the blocked payloads are dropped and CE pulled low, so that the
+		// chip leaves its Tx state before CE is raised again
+		ce = com_ce() && !_ce_pulse;
+		set_com_ce(0);
+		flush_tx();
+		clear_interrupt_flags(0x10);
+		if (faults & FAULT_TX_STALL) {
+			// the chip never left its Tx state with CE high: a power cycle
+			// resets its state machine
+			spi_write_register(RegisterAddress::REG_CONFIG, _registers[0] & 0xFD);
+			spi_write_register(RegisterAddress::REG_CONFIG, _registers[0]);
+			_powering_up = true;
+			_power_up_time = us_ticker_read();
+		}
+		if (ce) {
+			set_com_ce(1);
+		}
+	}
+
+	if (_event_queue) {
+		// the engines resume as on an interrupt: a stuck MAX_RT of the Tx
+		// stream is dropped and accounted there, the Tx FIFO refilled
+		_irq_timestamp = now;
+		process_interrupts();
 	}
-	spi_deselect();
-#else
-	static char reg;
-	reg = static_cast<char>(RegisterAddress::OP_RX);
-	spi_select();
-	_spi->write(&reg, 1, (char *)buffer, length);
-	spi_deselect();
-#endif
 }
 
-void NRF24L01::spi_write_register(RegisterAddress register_address, uint8_t value)
+uint32_t NRF24L01::tx_stall_time(void)
 {
-#ifdef _SPI_API_WITHOUT_CS_
-	spi_select();
-	_spi->write((static_cast<uint8_t>(register_address) | static_cast<uint8_t>(RegisterOperation::OP_WRITE)));
-	_spi->write(value);
-	spi_deselect();
-#else
-	static char data[2];
-	static char resp[2];
+	uint8_t setup_retr = register_value(RegisterAddress::REG_SETUP_RETR);
 
-	// formatting data
-	data[0] = (static_cast<char>(register_address) | static_cast<char>(RegisterAddress::OP_WRITE));
-	data[1] = value;
-	spi_select();
-	//TODO: ignore response?
-	_spi->write(data, sizeof(data), resp, sizeof(resp));
-	spi_deselect();
-#endif
+	// every retransmit of a full payload, each followed by its ACK delay
+	return SETTLING_TIME + ((setup_retr & 0x0F) + 1) * ((((setup_retr >> 4) + 1) * RETRANSMIT_DELAY_STEP)
+			+ airtime(data_rate(), 32, CRCwidth::_16bits));
 }
 
-void NRF24L01::spi_write_register(RegisterAddress register_address, const char *value, uint8_t length)
+uint8_t NRF24L01::register_value(RegisterAddress register_address)
 {
-#ifdef _SPI_API_WITHOUT_CS_
-	spi_select();
-	_spi->write((static_cast<uint8_t>(register_address) | static_cast<uint8_t>(RegisterOperation::OP_WRITE)));
-	while (length--) {
-		//TODO: ignore response?
-		_spi->write(*value++);
+	uint8_t address = static_cast<uint8_t>(register_address);
+
+	if (!(CACHED_REGISTERS_MASK & (1UL << address))) {
+		return spi_read_register(register_address);
 	}
-	spi_deselect();
-#else
-	static char *data;
-	static char resp[2];
-	// create a dynamic buffer to use mbed spi API
-	data = new char[length];
+	if (!_registers_valid) {
+		refresh_registers();
+	}
+
+	return _registers[address];
+}
 
-	// formatting data
-	data[0] = (static_cast<char>(register_address) | static_cast<char>(RegisterAddress::OP_WRITE));
+void NRF24L01::update_register(RegisterAddress register_address, uint8_t value)
+{
+	uint8_t address = static_cast<uint8_t>(register_address);
 
-	for (int i = 1; i < length; i++) {
-		data[i] = *value;
-		value++;
+	if (!(CACHED_REGISTERS_MASK & (1UL << address))) {
+		spi_write_register(register_address, value);
+		return;
+	}
+	if (!_registers_valid) {
+		refresh_registers();
 	}
-	spi_select();
-	//TODO: ignore response?
-	_spi->write(data, length, resp, sizeof(resp));
-	spi_deselect();
 
-	delete data;
-#endif
+	// skip the bus access when the chip already holds this value
+	if (_registers[address] != value) {
+		_registers[address] = value;
+		_dirty_registers |= (1UL << address);
+	}
+
+	if (!_deferred_sync) {
+		sync();
+	}
+}
+
+uint8_t NRF24L01::fetch_register(RegisterAddress register_address)
+{
+	uint8_t address = static_cast<uint8_t>(register_address);
+	uint8_t value = spi_read_register(register_address);
+
+	// keep the cache coherent unless a local change is still pending
+	if (_registers_valid && (CACHED_REGISTERS_MASK & (1UL << address))
+			&& !(_dirty_registers & (1UL << address)) && !(!address && _config_deferred)) {
+		_registers[address] = value;
+	}
+
+	return value;
+}
+
+/***************************************************************************
+ * transport layer
+ ***************************************************************************/
+void NRF24L01::spi_select(void)
+{
+	uint32_t elapsed = 0;
+
+	// only an access right after a CE rising edge has to wait
+	if (_ce_rising) {
+		elapsed = us_ticker_read() - _ce_time;
+		if (elapsed < HARDWARE_DELAY) {
+			wait_us(HARDWARE_DELAY - elapsed);
+		}
+		_ce_rising = false;
+	}
+	// STATUS is clocked out right after CS assertion
+	_select_time = us_ticker_read();
+	_com_cs = 0;
+}
+
+void NRF24L01::spi_deselect(void)
+{
+	_com_cs = 1;
+}
+
+void NRF24L01::spi_write_payload(const char *buffer, uint8_t length, RegisterOperation operation)
+{
+	spi_transfer(static_cast<uint8_t>(operation), buffer, NULL, length);
+}
+
+void NRF24L01::spi_read_payload(char* buffer, uint8_t length)
+{
+	spi_transfer(static_cast<uint8_t>(RegisterOperation::OP_RX), NULL, buffer, length);
+}
+
+void NRF24L01::spi_write_register(RegisterAddress register_address, uint8_t value)
+{
+	char data = static_cast<char>(value);
+
+	spi_transfer((static_cast<uint8_t>(register_address) | static_cast<uint8_t>(RegisterOperation::OP_WRITE)),
+			&data, NULL, 1);
+
+	// the STATUS clocked out predates the write: these flags are gone
+	if (register_address == RegisterAddress::REG_STATUS) {
+		_status_cleared = value & 0x70;
+	}
+}
+
+void NRF24L01::spi_write_register(RegisterAddress register_address, const char *value, uint8_t length)
+{
+	spi_transfer((static_cast<uint8_t>(register_address) | static_cast<uint8_t>(RegisterOperation::OP_WRITE)),
+			value, NULL, length);
 }
 
 uint8_t NRF24L01::spi_read_register(RegisterAddress register_address)
 {
-	static char reg;
+	char resp = 0;
 
-	reg = (static_cast<char>(RegisterOperation::OP_READ) | static_cast<char>(register_address));
+	spi_transfer((static_cast<uint8_t>(RegisterOperation::OP_READ) | static_cast<uint8_t>(register_address)),
+			NULL, &resp, 1);
 
-#ifdef _SPI_API_WITHOUT_CS_
-	static uint8_t resp = 0;
-	spi_select();
-	_spi->write(reg);
-	resp = _spi->write(static_cast<uint8_t>(RegisterOperation::OP_NOP));
-	spi_deselect();
-	return resp;
-#else
-	static char resp[2];
-	spi_select();
-	_spi->write(&reg, 1, resp, sizeof(resp));
-	spi_deselect();
-	return (uint8_t)resp[1];
-#endif
+	return static_cast<uint8_t>(resp);
 }
 
 void NRF24L01::spi_read_register(RegisterAddress register_address, uint8_t *value, uint8_t length)
 {
-	static char reg;
+	spi_transfer((static_cast<uint8_t>(RegisterOperation::OP_READ) | (static_cast<uint8_t>(register_address) & 0x1F)),
+			NULL, (char *)value, length);
+}
+
+uint8_t NRF24L01::spi_single_write(uint8_t value)
+{
+	return spi_transfer(value, NULL, NULL, 0);
+}
+
+uint8_t NRF24L01::rx_payload_length(uint8_t pipe)
+{
+	char length = 0;
+
+	// static payload width of the pipe
+	if (!(register_value(RegisterAddress::REG_FEATURE) & (1 << 2))
+			|| !(register_value(RegisterAddress::REG_DYNPD) & (1 << pipe))) {
+		return register_value(payload_size_register(static_cast<RxAddressPipe>(pipe)));
+	}
+
+	spi_transfer(static_cast<uint8_t>(RegisterOperation::OP_RX_PL_WID), NULL, &length, 1);
+
+	// a width above 32 bytes is corrupted, the payload must be flushed
+	if (static_cast<uint8_t>(length) > MAX_PAYLOAD_SIZE) {
+		flush_rx();
+	}
+
+	return static_cast<uint8_t>(length);
+}
+
+uint8_t NRF24L01::spi_transfer(uint8_t command, const char *tx_buffer, char *rx_buffer, uint8_t length)
+{
+	// a CONFIG write held by a CE pulse goes first, see write_config()
+	if (_config_deferred && !_ce_pulse) {
+		write_deferred_config();
+	}
 
-	// format register value
-	reg = (static_cast<char>(RegisterOperation::OP_READ) | (static_cast<char>(register_address) & 0x1F));
+	// command byte followed by at most one payload
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
 
 #ifdef _SPI_API_WITHOUT_CS_
+	uint8_t data = 0;
+
+	if (_group) {
+		// hold the shared bus for the whole frame
+		_group->lock();
+	}
 	spi_select();
-	_spi->write(reg);
-	while (length--) {
-		*value++ = _spi->write(static_cast<uint8_t>(RegisterOperation::OP_NOP));
+	capture_status(command, _spi->write(command));
+	for (uint8_t i = 0; i < length; i++) {
+		data = _spi->write(tx_buffer ? tx_buffer[i] : static_cast<uint8_t>(RegisterOperation::OP_NOP));
+		if (rx_buffer) {
+			rx_buffer[i] = data;
+		}
 	}
 	spi_deselect();
+	if (_group) {
+		_group->unlock();
+	}
 #else
+	// format the whole frame to clock it in a single block transfer
+	_spi_tx_frame[0] = static_cast<char>(command);
+	if (tx_buffer) {
+		memcpy(&_spi_tx_frame[1], tx_buffer, length);
+	} else {
+		memset(&_spi_tx_frame[1], static_cast<uint8_t>(RegisterOperation::OP_NOP), length);
+	}
+
+	if (_group) {
+		// hold the shared bus for the whole frame
+		_group->lock();
+	}
 	spi_select();
-	// spi write sequence
-	_spi->write(&reg, 1, (char *)value, length);
+	_spi->write(_spi_tx_frame, length + 1, _spi_rx_frame, length + 1);
 	spi_deselect();
+	if (_group) {
+		_group->unlock();
+	}
+
+	// first byte clocked out is always the STATUS register
+	capture_status(command, _spi_rx_frame[0]);
+	if (rx_buffer) {
+		memcpy(rx_buffer, &_spi_rx_frame[1], length);
+	}
 #endif
 
+	_statistics.spi_transactions++;
+	_statistics.spi_bytes += length + 1;
+
+	return _status;
 }
 
-uint8_t NRF24L01::spi_single_write(uint8_t value)
+void NRF24L01::capture_status(uint8_t command, uint8_t status)
+{
+	_status = status;
+	_status_time = _select_time;
+	// W_TX_PAYLOAD, W_ACK_PAYLOAD and W_TX_PAYLOAD_NOACK: the TX_FULL
+	// clocked out is the one before the payload is loaded
+	_status_loaded = ((command & 0xE0) == 0xA0);
+	_status_cleared = 0;
+}
+
+bool NRF24L01::tx_fifo_full(void)
 {
-	uint8_t resp = 0xff;
+	// TX_FULL only rises when a payload is loaded: a captured "not full"
+	// holds until then, a captured "full" may be outdated
+	if (!(_status & 0x01) && !_status_loaded) {
+		return false;
+	}
+
+	return (status_register() & 0x01);
+}
+
+uint8_t NRF24L01::spi_transfer_frame(char *frame, uint8_t length, bool receive)
+{
+	// frame[0] holds the command and receives STATUS, the payload is
+	// clocked from or into the rest of the frame without any copy
+	char command = frame[0];
+	char status = 0;
+
+	if (_config_deferred && !_ce_pulse) {
+		write_deferred_config();
+	}
+
+	if (length > MAX_PAYLOAD_SIZE) {
+		length = MAX_PAYLOAD_SIZE;
+	}
+
+	if (_group) {
+		// hold the shared bus for the whole frame
+		_group->lock();
+	}
 	spi_select();
-	resp = _spi->write(value);
+#ifdef _SPI_API_WITHOUT_CS_
+	status = _spi->write(command);
+	for (uint8_t i = 1; i <= length; i++) {
+		if (receive) {
+			frame[i] = _spi->write(static_cast<uint8_t>(RegisterOperation::OP_NOP));
+		} else {
+			_spi->write(frame[i]);
+		}
+	}
+#else
+	if (receive) {
+		// NOP fill bytes after the command
+		_spi->write(&command, 1, frame, length + 1);
+		status = frame[0];
+	} else {
+		_spi->write(frame, length + 1, &status, 1);
+	}
+#endif
 	spi_deselect();
+	if (_group) {
+		_group->unlock();
+	}
 
-	return resp;
-}
+	capture_status(command, status);
+	_statistics.spi_transactions++;
+	_statistics.spi_bytes += length + 1;
 
-//void NRF24L01::spi_multiple_write(uint8_t register_value, uint8_t *resp, uint8_t length)
-//{
-//	spi_select();
-//	_spi->write((const char *)register_value, 1, (char *)resp, length);
-//	spi_deselect();
-//}
+	return _status;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "nrf24l01/packet_pool.h"
+
+namespace {
+#define MAX_PAYLOAD_SIZE		32 // in bytes
+}
+
+PacketPool::PacketPool(Buffer *buffers, uint8_t count)
+{
+	_buffers = buffers;
+	_count = (count > MAX_BUFFERS) ? MAX_BUFFERS : count;
+
+	// every buffer starts in the free list, in storage order
+	for (uint8_t i = 0; i < _count; i++) {
+		_buffers[i].next = (i + 1 < _count) ? (i + 1) : NO_BUFFER;
+		_buffers[i].generation = 0;
+		_buffers[i].allocated = false;
+	}
+	_free = _count ? 0 : NO_BUFFER;
+
+	memset(&_statistics, 0, sizeof(_statistics));
+	_statistics.size = _count;
+}
+
+PacketPool::Handle PacketPool::allocate(void)
+{
+	CriticalSectionLock lock;
+	uint8_t index = _free;
+
+	if (index == NO_BUFFER) {
+		_statistics.failures++;
+		return INVALID_HANDLE;
+	}
+	_free = _buffers[index].next;
+	_buffers[index].allocated = true;
+	_buffers[index].length = 0;
+	_buffers[index].pipe = 0;
+	_buffers[index].timestamp = 0;
+
+	_statistics.allocations++;
+	_statistics.in_use++;
+	if (_statistics.in_use > _statistics.high_water_mark) {
+		_statistics.high_water_mark = _statistics.in_use;
+	}
+
+	return (static_cast<Handle>(_buffers[index].generation) << 8) | index;
+}
+
+void PacketPool::release(Handle handle)
+{
+	CriticalSectionLock lock;
+	Buffer *allocated = buffer(handle);
+
+	// a buffer already in the free list is ignored, not linked twice, and
+	// so is a stale handle of a buffer allocated again since
+	if (!allocated) {
+		return;
+	}
+	allocated->allocated = false;
+	allocated->generation++;
+	allocated->next = _free;
+	_free = handle & 0xFF;
+	_statistics.in_use--;
+}
+
+uint8_t PacketPool::available(void)
+{
+	return _count - _statistics.in_use;
+}
+
+uint8_t *PacketPool::payload(Handle handle)
+{
+	Buffer *allocated = buffer(handle);
+
+	return allocated ? reinterpret_cast<uint8_t *>(&allocated->frame[1]) : NULL;
+}
+
+uint8_t PacketPool::length(Handle handle)
+{
+	Buffer *allocated = buffer(handle);
+
+	return allocated ? allocated->length : 0;
+}
+
+void PacketPool::set_length(Handle handle, uint8_t length)
+{
+	Buffer *allocated = buffer(handle);
+
+	if (allocated) {
+		allocated->length = (length > MAX_PAYLOAD_SIZE) ? MAX_PAYLOAD_SIZE : length;
+	}
+}
+
+uint8_t PacketPool::pipe(Handle handle)
+{
+	Buffer *allocated = buffer(handle);
+
+	return allocated ? allocated->pipe : 0;
+}
+
+uint32_t PacketPool::timestamp(Handle handle)
+{
+	Buffer *allocated = buffer(handle);
+
+	return allocated ? allocated->timestamp : 0;
+}
+
+PacketPool::Statistics PacketPool::statistics(void)
+{
+	CriticalSectionLock lock;
+
+	return _statistics;
+}
+
+void PacketPool::reset_statistics(void)
+{
+	CriticalSectionLock lock;
+
+	// the high water mark restarts from the buffers currently owned
+	_statistics.allocations = 0;
+	_statistics.failures = 0;
+	_statistics.high_water_mark = _statistics.in_use;
+}
+
+PacketPool::Buffer *PacketPool::buffer(Handle handle)
+{
+	uint8_t index = handle & 0xFF;
+
+	if ((index >= _count) || !_buffers[index].allocated || (_buffers[index].generation != (handle >> 8))) {
+		return NULL;
+	}
+
+	return &_buffers[index];
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "nrf24l01/radio_group.h"
+#include "nrf24l01/nrf24l01.h"
+
+RadioGroup::RadioGroup(SPI *spi, EventQueue *queue)
+{
+	_spi = spi;
+	// shared by every radio of the group, configured once
+	_spi->format(8,0);
+	_event_queue = queue;
+	_count = 0;
+	_pending = 0;
+	_dispatch_posted = false;
+	_bus_busy = false;
+	_async_waiting = 0;
+}
+
+SPI *RadioGroup::spi(void)
+{
+	return _spi;
+}
+
+EventQueue *RadioGroup::event_queue(void)
+{
+	return _event_queue;
+}
+
+uint8_t RadioGroup::radio_count(void)
+{
+	return _count;
+}
+
+void RadioGroup::lock(void)
+{
+	_spi->lock();
+
+	// an asynchronous transfer in progress completes from its interrupt
+	while (!acquire(-1)) {
+		wait_us(1);
+	}
+}
+
+void RadioGroup::unlock(void)
+{
+	release();
+	_spi->unlock();
+}
+
+int RadioGroup::attach(NRF24L01 *radio, uint8_t priority)
+{
+	uint8_t i = 0;
+
+	if (_count >= MAX_RADIOS) {
+		return -1;
+	}
+	_radios[_count] = radio;
+	_priorities[_count] = priority;
+
+	// insertion sort, radios of the same priority keep their attach order
+	for (i = _count; (i > 0) && (_priorities[_order[i - 1]] > priority); i--) {
+		_order[i] = _order[i - 1];
+	}
+	_order[i] = _count;
+
+	return _count++;
+}
+
+bool RadioGroup::acquire(int index)
+{
+	CriticalSectionLock lock;
+
+	if (_bus_busy) {
+		// asynchronous transfers are started again by release()
+		if (index >= 0) {
+			_async_waiting |= (1 << index);
+		}
+		return false;
+	}
+	_bus_busy = true;
+
+	return true;
+}
+
+void RadioGroup::release(void)
+{
+	int index = -1;
+
+	{
+		CriticalSectionLock lock;
+
+		_bus_busy = false;
+		for (uint8_t i = 0; i < _count; i++) {
+			if (_async_waiting & (1 << _order[i])) {
+				_async_waiting &= ~(1 << _order[i]);
+				index = _order[i];
+				break;
+			}
+		}
+	}
+
+#if DEVICE_SPI_ASYNCH
+	// highest priority deferred transfer first, interrupt context safe
+	if (index >= 0) {
+		_radios[index]->async_start();
+	}
+#endif
+}
+
+void RadioGroup::notify(uint8_t index)
+{
+	bool post = false;
+
+	{
+		CriticalSectionLock lock;
+
+		_pending |= (1 << index);
+		post = !_dispatch_posted;
+		_dispatch_posted = true;
+	}
+	if (post) {
+		_event_queue->call(callback(this, &RadioGroup::dispatch));
+	}
+}
+
+void RadioGroup::dispatch(void)
+{
+	int index = 0;
+	bool repost = false;
+
+	// one radio at a time, rescanning from the highest priority so that a
+	// radio raising its IRQ meanwhile does not wait behind lower ones
+	while ((index = next_pending()) >= 0) {
+		_radios[index]->process_interrupts();
+	}
+
+	{
+		CriticalSectionLock lock;
+
+		// an IRQ raised since the last scan did not post a dispatch
+		repost = (_pending != 0);
+		_dispatch_posted = repost;
+	}
+	if (repost) {
+		_event_queue->call(callback(this, &RadioGroup::dispatch));
+	}
+}
+
+int RadioGroup::next_pending(void)
+{
+	CriticalSectionLock lock;
+
+	for (uint8_t i = 0; i < _count; i++) {
+		if (_pending & (1 << _order[i])) {
+			_pending &= ~(1 << _order[i]);
+			return _order[i];
+		}
+	}
+
+	return -1;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "nrf24l01/radio_watchdog.h"
+
+RadioWatchdog::RadioWatchdog(NRF24L01 *radio, EventQueue *queue)
+{
+	_radio = radio;
+	_event_queue = queue;
+	_period = 0;
+	_next_check = 0;
+	_running = false;
+	memset(&_statistics, 0, sizeof(_statistics));
+}
+
+void RadioWatchdog::attach(Callback<void(const Recovery &)> func)
+{
+	_recovery_callback = func;
+}
+
+void RadioWatchdog::start(uint32_t period)
+{
+	if (!period) {
+		return;
+	}
+	_period = period;
+	_running = true;
+
+	_next_check = us_ticker_read() + _period;
+	arm();
+}
+
+void RadioWatchdog::stop(void)
+{
+	_running = false;
+	_check_timeout.detach();
+}
+
+uint8_t RadioWatchdog::check(void)
+{
+	uint8_t faults = _radio->check_health();
+
+	_statistics.checks++;
+	if (faults) {
+		recover(faults, us_ticker_read());
+	}
+
+	return faults;
+}
+
+RadioWatchdog::Statistics RadioWatchdog::statistics(void)
+{
+	return _statistics;
+}
+
+void RadioWatchdog::reset_statistics(void)
+{
+	memset(&_statistics, 0, sizeof(_statistics));
+}
+
+void RadioWatchdog::recover(uint8_t faults, uint32_t timestamp)
+{
+	Recovery recovery;
+	uint32_t transactions = _radio->statistics().spi_transactions;
+
+	_radio->recover(faults);
+
+	recovery.timestamp = timestamp;
+	recovery.faults = faults;
+	recovery.spi_transactions = _radio->statistics().spi_transactions - transactions;
+	recovery.duration = us_ticker_read() - timestamp + _radio->time_to_ready();
+
+	_statistics.recoveries++;
+	for (uint8_t i = 0; i < NRF24L01::FAULT_COUNT; i++) {
+		if (faults & (1 << i)) {
+			_statistics.faults[i]++;
+		}
+	}
+	_statistics.duration_sum += recovery.duration;
+	if (recovery.duration > _statistics.duration_max) {
+		_statistics.duration_max = recovery.duration;
+	}
+
+	if (_recovery_callback) {
+		_recovery_callback(recovery);
+	}
+}
+
+void RadioWatchdog::arm(void)
+{
+	_check_timeout.attach_at(_event_queue, callback(this, &RadioWatchdog::timed_check), _next_check);
+}
+
+void RadioWatchdog::timed_check(void)
+{
+	if (!_running) {
+		return;
+	}
+
+	check();
+	_next_check += _period;
+	arm();
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2019, CATIE
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "nrf24l01/tdma_scheduler.h"
+
+namespace {
+#define PRELOAD_TIME			200	// in µs, preload ahead of a slot boundary
+#define START_DELAY				1000 // in µs
+#define DEFAULT_GUARD_TIME		50	// in µs
+#define STATUS_TX_DS			0x20
+#define STATUS_MAX_RT			0x10
+}
+
+TdmaScheduler::TdmaScheduler(NRF24L01 *radio, EventQueue *queue)
+{
+	_radio = radio;
+	_event_queue = queue;
+	_slot_count = 0;
+	_phase_count = 0;
+	_guard_time = DEFAULT_GUARD_TIME;
+	_retransmits = 0;
+	_period = 0;
+	_retransmit_delay = 0;
+	_retransmit_count = 0;
+	_running = false;
+	_replies = false;
+	_superframe_start = 0;
+	_boundary = 0;
+	_phase = 0;
+	_active = -1;
+	_preloaded = false;
+	_address_slot = -1;
+	_reply_slot = 0;
+	memset(&_statistics, 0, sizeof(_statistics));
+}
+
+int TdmaScheduler::add_slot(uint64_t address, bool reply, bool ack)
+{
+	Slot *slot = &_slots[_slot_count];
+
+	if (_running || (_slot_count >= MAX_SLOTS)) {
+		return -1;
+	}
+
+	// addresses are sent LSByte first
+	for (uint8_t i = 0; i < 5; i++) {
+		slot->address[i] = (address >> (8 * i)) & 0xFF;
+	}
+	slot->reply = reply;
+	slot->ack = ack;
+	// zeros until the first command is set
+	slot->length = _radio->payload_size();
+	memset(slot->command, 0, sizeof(slot->command));
+
+	_replies |= reply;
+
+	return _slot_count++;
+}
+
+bool TdmaScheduler::set_command(uint8_t slot, const void *buffer, uint8_t length)
+{
+	CriticalSectionLock lock;
+
+	if ((slot >= _slot_count) || (length > sizeof(_slots[slot].command))) {
+		return false;
+	}
+	// latched at the next preload of the slot
+	memcpy(_slots[slot].command, buffer, length);
+	_slots[slot].length = length;
+
+	return true;
+}
+
+void TdmaScheduler::attach_reply(Callback<void(uint8_t, const NRF24L01::RxPacket &)> func)
+{
+	_reply_callback = func;
+}
+
+void TdmaScheduler::set_guard_time(uint16_t guard_time)
+{
+	_guard_time = guard_time;
+}
+
+void TdmaScheduler::set_retransmits(uint8_t count)
+{
+	_retransmits = count;
+}
+
+uint32_t TdmaScheduler::command_window(void)
+{
+	NRF24L01::DataRate data_rate = _radio->data_rate();
+	NRF24L01::CRCwidth crc_width = _radio->crc_width();
+	uint32_t airtime = NRF24L01::airtime(data_rate, _radio->payload_size(), crc_width);
+
+	// every attempt waits up to ARD for its ACK, MAX_RT is raised after the last
+	return NRF24L01::SETTLING_TIME + (_retransmits + 1) * (airtime + _radio->minimum_retransmit_delay());
+}
+
+uint32_t TdmaScheduler::reply_window(void)
+{
+	NRF24L01::DataRate data_rate = _radio->data_rate();
+	NRF24L01::CRCwidth crc_width = _radio->crc_width();
+
+	// Rx settling, then the reply and its ACK
+	return NRF24L01::SETTLING_TIME + NRF24L01::airtime(data_rate, _radio->payload_size(), crc_width)
+			+ NRF24L01::SETTLING_TIME + NRF24L01::airtime(data_rate, 0, crc_width);
+}
+
+uint32_t TdmaScheduler::superframe_duration(void)
+{
+	build_phases();
+
+	if (!_phase_count) {
+		return 0;
+	}
+
+	return _phases[_phase_count - 1].start
+			+ (_phases[_phase_count - 1].reply ? reply_window() : command_window()) + _guard_time;
+}
+
+bool TdmaScheduler::start(uint32_t period)
+{
+	if (_running || !_slot_count || (superframe_duration() > period)) {
+		return false;
+	}
+	_period = period;
+
+	_radio->set_com_ce(0);
+	_radio->set_mode(NRF24L01::OperationMode::TRANSCEIVER);
+	// Tx completion is read at the end of each slot
+	_radio->set_interrupt(NRF24L01::InterruptMode::RX_ONLY);
+	_radio->clear_interrupt_flags();
+	_retransmit_delay = _radio->auto_retransmit_delay();
+	_retransmit_count = _radio->auto_retransmit_count();
+	_radio->set_auto_retransmit(_radio->minimum_retransmit_delay(), _retransmits);
+	if (_replies) {
+		_radio->start_rx_engine(_event_queue, callback(this, &TdmaScheduler::received));
+	}
+
+	_address_slot = -1;
+	_active = -1;
+	_preloaded = false;
+	_phase = 0;
+	_running = true;
+	_radio->set_engine_active(NRF24L01::ENGINE_TDMA, true);
+
+	_superframe_start = us_ticker_read() + START_DELAY;
+	arm();
+
+	return true;
+}
+
+void TdmaScheduler::stop(void)
+{
+	if (!_running) {
+		return;
+	}
+	_running = false;
+	_preload_timeout.detach();
+	_boundary_timeout.detach();
+
+	_radio->set_com_ce(0);
+	_radio->flush_tx();
+	_radio->set_mode(NRF24L01::OperationMode::TRANSCEIVER);
+	_radio->set_auto_retransmit(_retransmit_delay, _retransmit_count);
+	if (_replies) {
+		_radio->stop_rx_engine();
+	}
+	_radio->set_engine_active(NRF24L01::ENGINE_TDMA, false);
+}
+
+TdmaScheduler::Statistics TdmaScheduler::statistics(void)
+{
+	CriticalSectionLock lock;
+
+	return _statistics;
+}
+
+void TdmaScheduler::reset_statistics(void)
+{
+	CriticalSectionLock lock;
+
+	memset(&_statistics, 0, sizeof(_statistics));
+}
+
+void TdmaScheduler::build_phases(void)
+{
+	uint32_t command = command_window() + _guard_time;
+	uint32_t reply = reply_window() + _guard_time;
+	uint32_t offset = 0;
+
+	_phase_count = 0;
+	for (uint8_t slot = 0; slot < _slot_count; slot++) {
+		offset += PRELOAD_TIME;
+		_phases[_phase_count].slot = slot;
+		_phases[_phase_count].reply = false;
+		_phases[_phase_count].start = offset;
+		_phase_count++;
+		offset += command;
+
+		if (_slots[slot].reply) {
+			offset += PRELOAD_TIME;
+			_phases[_phase_count].slot = slot;
+			_phases[_phase_count].reply = true;
+			_phases[_phase_count].start = offset;
+			_phase_count++;
+			offset += reply;
+		}
+	}
+}
+
+void TdmaScheduler::arm(void)
+{
+	uint32_t now = us_ticker_read();
+	uint32_t preload = 0;
+
+	// absolute targets: timer latencies do not accumulate
+	_boundary = _superframe_start + _phases[_phase].start;
+	preload = _boundary - PRELOAD_TIME;
+
+	_preload_timeout.attach_at(_event_queue, callback(this, &TdmaScheduler::preload), preload);
+	_boundary_timeout.attach_us(callback(this, &TdmaScheduler::boundary_handler),
+			(static_cast<int32_t>(_boundary - now) > 0) ? (_boundary - now) : 0);
+}
+
+void TdmaScheduler::boundary_handler(void)
+{
+	uint32_t jitter = us_ticker_read() - _boundary;
+	uint8_t phase = _phase;
+
+	_statistics.slots++;
+	_statistics.jitter_sum += jitter;
+	if (jitter > _statistics.jitter_max) {
+		_statistics.jitter_max = jitter;
+	}
+
+	if (_preloaded) {
+		// the payload or the Rx setup is ready, only CE is left
+		_radio->set_com_ce(1);
+		_active = phase;
+	} else {
+		// the phase in progress ends here, its flags are collected by the
+		// late preload; the slot is skipped
+		_radio->set_com_ce(0);
+		_statistics.missed++;
+	}
+	_preloaded = false;
+
+	phase++;
+	if (phase >= _phase_count) {
+		phase = 0;
+		_superframe_start += _period;
+		_statistics.superframes++;
+	}
+	_phase = phase;
+	arm();
+}
+
+void TdmaScheduler::preload(void)
+{
+	if (!_running) {
+		return;
+	}
+
+	if (_active >= 0) {
+		finish(_active);
+		_active = -1;
+	}
+	if (!_preloaded) {
+		prepare(_phase);
+		_preloaded = true;
+	}
+}
+
+void TdmaScheduler::finish(int phase)
+{
+	uint8_t status = 0;
+
+	_radio->set_com_ce(0);
+
+	if (_phases[phase].reply) {
+		_radio->set_mode(NRF24L01::OperationMode::TRANSCEIVER);
+		return;
+	}
+
+	status = _radio->status_register();
+	if (status & STATUS_TX_DS) {
+		_statistics.delivered++;
+	} else if (status & STATUS_MAX_RT) {
+		_statistics.failed++;
+	} else {
+		_statistics.overruns++;
+	}
+	if (!(status & STATUS_TX_DS)) {
+		// the next slot must start from an empty Tx FIFO
+		_radio->flush_tx();
+	}
+	_radio->clear_interrupt_flags(STATUS_TX_DS | STATUS_MAX_RT);
+}
+
+void TdmaScheduler::prepare(uint8_t phase)
+{
+	Slot *slot = &_slots[_phases[phase].slot];
+	uint8_t command[32];
+	uint8_t length = 0;
+
+	select_address(_phases[phase].slot);
+
+	if (_phases[phase].reply) {
+		_reply_slot = _phases[phase].slot;
+		_radio->set_mode(NRF24L01::OperationMode::RECEIVER);
+		return;
+	}
+
+	{
+		CriticalSectionLock lock;
+
+		length = slot->length;
+		memcpy(command, slot->command, length);
+	}
+	_radio->load_packet(command, length, slot->ack);
+}
+
+void TdmaScheduler::select_address(uint8_t slot)
+{
+	if (_address_slot == slot) {
+		return;
+	}
+
+	// pipe 0 receives the ACKs and the replies of the robot
+	_radio->set_tx_address(_slots[slot].address);
+	_radio->attach_receive_address_to_pipe(NRF24L01::RxAddressPipe::RX_ADDR_P0, _slots[slot].address);
+	_address_slot = slot;
+}
+
+void TdmaScheduler::received(void)
+{
+	NRF24L01::RxPacket packet;
+
+	// replies are drained before the next reply window is prepared
+	while (_radio->receive(&packet)) {
+		_statistics.replies++;
+		if (_reply_callback) {
+			_reply_callback(_reply_slot, packet);
+		}
+	}
+}